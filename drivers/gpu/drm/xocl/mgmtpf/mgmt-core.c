@@ -19,6 +19,7 @@
 #include <linux/platform_device.h>
 #include <linux/i2c.h>
 #include <linux/crc32c.h>
+#include <linux/firmware.h>
 #include "../xocl_drv.h"
 #include "../version.h"
 
@@ -432,16 +433,34 @@ static int health_check_cb(void *data)
 	if (!health_check)
 		return 0;
 
-	mutex_lock(&lro->busy_mutex);
-	tripped = xocl_af_check(lro, NULL);
-	mutex_unlock(&lro->busy_mutex);
+	/*
+	 * The register sweep runs without busy_mutex so management ioctls
+	 * never queue behind it on a slow bus. When the shell routes firewall
+	 * trips to an interrupt, the firewall subdev reports them itself and
+	 * the sweep is skipped. Once tripped, the vector stays masked until
+	 * the firewall is cleared, so the sweep resumes and the peer is
+	 * notified again on every pass in case the first notify was lost.
+	 */
+	if (xocl_af_intr_enabled(lro))
+		tripped = false;
+	else
+		tripped = xocl_af_check(lro, NULL);
 
 	if (!tripped) {
 		check_sysmon(lro);
-	} else {
+		return 0;
+	}
+
+	/*
+	 * Act on the trip under busy_mutex, after any in-flight download or
+	 * reset has finished. Those may have cleared the firewall meanwhile.
+	 */
+	mutex_lock(&lro->busy_mutex);
+	if (xocl_af_get_status(lro, NULL)) {
 		mgmt_info(lro, "firewall tripped, notify peer");
 		(void) xocl_peer_notify(lro, &mbreq, sizeof(struct mailbox_req));
 	}
+	mutex_unlock(&lro->busy_mutex);
 
 	return 0;
 }
@@ -535,6 +554,36 @@ struct xocl_pci_funcs xclmgmt_pci_ops = {
 	.reset = xclmgmt_reset,
 };
 
+static int xclmgmt_sensor_snapshot(struct xclmgmt_dev *lro, void **resp,
+	size_t *sz)
+{
+	struct mailbox_sensor_snapshot *snap;
+	int level = 0;
+	u32 i;
+
+	snap = vzalloc(sizeof(*snap));
+	if (!snap)
+		return -ENOMEM;
+
+	(void) xocl_xmc_get_sensors(lro, snap->xmc_regs,
+		sizeof(snap->xmc_regs));
+	for (i = 0; i < ARRAY_SIZE(snap->sysmon); i++)
+		(void) xocl_sysmon_get_prop(lro, i, &snap->sysmon[i]);
+	(void) xocl_af_get_prop(lro, XOCL_AF_PROP_STATUS, &snap->af_status);
+	(void) xocl_af_get_prop(lro, XOCL_AF_PROP_LEVEL, &level);
+	snap->af_level = level;
+	(void) xocl_af_get_prop(lro, XOCL_AF_PROP_DETECTED_STATUS,
+		&snap->af_detected_status);
+	(void) xocl_af_get_prop(lro, XOCL_AF_PROP_DETECTED_LEVEL,
+		&snap->af_detected_level);
+	(void) xocl_af_get_prop(lro, XOCL_AF_PROP_DETECTED_TIME,
+		&snap->af_detected_time);
+
+	*resp = snap;
+	*sz = sizeof(*snap);
+	return 0;
+}
+
 static int xclmgmt_read_subdev_req(struct xclmgmt_dev *lro, char *data_ptr, void **resp, size_t *sz)
 {
 	uint64_t val = 0;
@@ -542,12 +591,18 @@ static int xclmgmt_read_subdev_req(struct xclmgmt_dev *lro, char *data_ptr, void
 	void *ptr = NULL;
 	struct mailbox_subdev_peer *subdev_req = (struct mailbox_subdev_peer *)data_ptr;
 	switch (subdev_req->kind) {
+	case SENSOR_SNAPSHOT:
+		return xclmgmt_sensor_snapshot(lro, resp, sz);
 	case VOL_12V_PEX:
 		val = xocl_xmc_get_data(lro, subdev_req->kind);
 		resp_sz = sizeof(u32);
 		ptr = (void *)&val;
 		break;
 	case IDCODE:
+	case CLOCK_FREQ_0:
+	case CLOCK_FREQ_1:
+	case FREQ_COUNTER_0:
+	case FREQ_COUNTER_1:
 		val = xocl_icap_get_data(lro, subdev_req->kind);
 		resp_sz = sizeof(u32);
 		ptr = (void *)&val;
@@ -572,21 +627,53 @@ static int xclmgmt_read_subdev_req(struct xclmgmt_dev *lro, char *data_ptr, void
 	return 0;
 }
 
-static void xclmgmt_mailbox_srv(void *arg, void *data, size_t len,
-	u64 msgid, int err)
+/*
+ * Load an xclbin staged on the host under xilinx/<uuid>.xclbin in the
+ * firmware search path, so a peer in another domain only has to send the
+ * uuid. The peer may hold a compacted copy, so only the uuid is matched
+ * and the length it sends is just logged. Returns -ENOENT when nothing
+ * usable is staged so the peer falls back to sending the whole xclbin.
+ */
+static int xclmgmt_load_xclbin_uuid(struct xclmgmt_dev *lro,
+	struct mailbox_bitstream_uuid *mb_uuid)
+{
+	char fw_name[64];
+	const struct firmware *fw = NULL;
+	const struct axlf *xclbin;
+	int ret;
+
+	snprintf(fw_name, sizeof(fw_name), "xilinx/%pUb.xclbin",
+		&mb_uuid->uuid);
+	if (request_firmware_direct(&fw, fw_name, &lro->core.pdev->dev))
+		return -ENOENT;
+
+	xclbin = (const struct axlf *)fw->data;
+	if (fw->size < sizeof(*xclbin) ||
+		xclbin->m_header.m_length > fw->size ||
+		!uuid_equal(&xclbin->m_header.uuid, &mb_uuid->uuid)) {
+		mgmt_err(lro, "staged %s does not match request", fw_name);
+		ret = -ENOENT;
+	} else {
+		mgmt_info(lro, "loading staged %s, %llu bytes (peer has %llu)",
+			fw_name, xclbin->m_header.m_length, mb_uuid->length);
+		ret = xocl_icap_download_axlf(lro, xclbin, fw->size, 0);
+	}
+
+	release_firmware(fw);
+	return ret;
+}
+
+static void xclmgmt_mailbox_handle(struct xclmgmt_dev *lro, void *data,
+	size_t len, u64 msgid)
 {
 	int ret = 0;
 	size_t sz = 0;
-	struct xclmgmt_dev *lro = (struct xclmgmt_dev *)arg;
 	struct mailbox_req *req = (struct mailbox_req *)data;
 	struct mailbox_req_bitstream_lock *bitstm_lock = NULL;
 	struct mailbox_bitstream_kaddr *mb_kaddr = NULL;
 	void *resp = NULL;
 	bitstm_lock =	(struct mailbox_req_bitstream_lock *)req->data;
 
-	if (err != 0)
-		return;
-
 	printk(KERN_INFO "%s received request (%d) from peer\n", __func__, req->req);
 
 	switch (req->req) {
@@ -605,11 +692,19 @@ static void xclmgmt_mailbox_srv(void *arg, void *data, size_t len,
 		break;
 	case MAILBOX_REQ_LOAD_XCLBIN_KADDR:
 		mb_kaddr = (struct mailbox_bitstream_kaddr *)req->data;
-		ret = xocl_icap_download_axlf(lro, (void *)mb_kaddr->addr);
+		/* Peer buffer in this kernel, only its own header sizes it. */
+		ret = xocl_icap_download_axlf(lro, (void *)mb_kaddr->addr,
+			((struct axlf *)mb_kaddr->addr)->m_header.m_length, 0);
 		(void) xocl_peer_response(lro, msgid, &ret, sizeof (ret));
 		break;
 	case MAILBOX_REQ_LOAD_XCLBIN:
-		ret = xocl_icap_download_axlf(lro, req->data);
+		ret = xocl_icap_download_axlf(lro, req->data,
+			len > sizeof(*req) ? len - sizeof(*req) : 0, 0);
+		(void) xocl_peer_response(lro, msgid, &ret, sizeof (ret));
+		break;
+	case MAILBOX_REQ_LOAD_XCLBIN_UUID:
+		ret = xclmgmt_load_xclbin_uuid(lro,
+			(struct mailbox_bitstream_uuid *)req->data);
 		(void) xocl_peer_response(lro, msgid, &ret, sizeof (ret));
 		break;
 	case MAILBOX_REQ_RECLOCK:
@@ -631,6 +726,98 @@ static void xclmgmt_mailbox_srv(void *arg, void *data, size_t len,
 	}
 }
 
+/*
+ * Requests that change bitstream, clock or reset state are handled in the
+ * order they arrive, one at a time. Everything else may run concurrently.
+ */
+static bool xclmgmt_mailbox_serial(u32 req)
+{
+	switch (req) {
+	case MAILBOX_REQ_LOCK_BITSTREAM:
+	case MAILBOX_REQ_UNLOCK_BITSTREAM:
+	case MAILBOX_REQ_HOT_RESET:
+	case MAILBOX_REQ_LOAD_XCLBIN_KADDR:
+	case MAILBOX_REQ_LOAD_XCLBIN:
+	case MAILBOX_REQ_LOAD_XCLBIN_UUID:
+	case MAILBOX_REQ_RECLOCK:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static void xclmgmt_mailbox_work(struct work_struct *work)
+{
+	struct xclmgmt_mbx_work *w =
+		container_of(work, struct xclmgmt_mbx_work, work);
+	struct xclmgmt_dev *lro = w->lro;
+	struct mailbox_req *req = (struct mailbox_req *)w->data;
+
+	/* A reset must not overlap with any other request. */
+	if (req->req == MAILBOX_REQ_HOT_RESET) {
+		down_write(&lro->mbx_srv_sem);
+		xclmgmt_mailbox_handle(lro, w->data, w->len, w->msgid);
+		up_write(&lro->mbx_srv_sem);
+	} else {
+		down_read(&lro->mbx_srv_sem);
+		xclmgmt_mailbox_handle(lro, w->data, w->len, w->msgid);
+		up_read(&lro->mbx_srv_sem);
+	}
+	vfree(w);
+}
+
+/*
+ * Called in the mailbox listening thread. The request buffer only lives
+ * until we return, so hand a copy to a worker and go back to listening.
+ */
+static void xclmgmt_mailbox_srv(void *arg, void *data, size_t len,
+	u64 msgid, int err)
+{
+	struct xclmgmt_dev *lro = (struct xclmgmt_dev *)arg;
+	struct mailbox_req *req = (struct mailbox_req *)data;
+	struct workqueue_struct *wq;
+	struct xclmgmt_mbx_work *w;
+
+	if (err != 0 || len < sizeof(struct mailbox_req))
+		return;
+
+	wq = xclmgmt_mailbox_serial(req->req) ? lro->mbx_serial_wq :
+		lro->mbx_srv_wq;
+	w = wq ? vmalloc(sizeof(*w) + len) : NULL;
+	if (!w) {
+		xclmgmt_mailbox_handle(lro, data, len, msgid);
+		return;
+	}
+
+	INIT_WORK(&w->work, xclmgmt_mailbox_work);
+	w->lro = lro;
+	w->msgid = msgid;
+	w->len = len;
+	memcpy(w->data, data, len);
+	queue_work(wq, &w->work);
+}
+
+static void xclmgmt_mailbox_srv_init(struct xclmgmt_dev *lro)
+{
+	init_rwsem(&lro->mbx_srv_sem);
+	lro->mbx_srv_wq = alloc_workqueue("xclmgmt-mbx.%d", WQ_UNBOUND,
+		MGMT_MBX_SRV_WORKERS, lro->instance);
+	lro->mbx_serial_wq = alloc_ordered_workqueue("xclmgmt-mbx-serial.%d",
+		0, lro->instance);
+	if (!lro->mbx_srv_wq || !lro->mbx_serial_wq)
+		mgmt_err(lro, "no mailbox workers, serving requests inline");
+}
+
+static void xclmgmt_mailbox_srv_fini(struct xclmgmt_dev *lro)
+{
+	if (lro->mbx_srv_wq)
+		destroy_workqueue(lro->mbx_srv_wq);
+	if (lro->mbx_serial_wq)
+		destroy_workqueue(lro->mbx_serial_wq);
+	lro->mbx_srv_wq = NULL;
+	lro->mbx_serial_wq = NULL;
+}
+
 /*
  * Called after minimum initialization is done. Should not return failure.
  * If something goes wrong, it should clean up and return back to minimum
@@ -681,6 +868,7 @@ static void xclmgmt_extended_probe(struct xclmgmt_dev *lro)
 	lro->core.thread_arg.interval = health_interval * 1000;
 
 	health_thread_start(lro);
+	mgmt_clk_gov_start(lro);
 
 	/* Launch the mailbox server. */
 	(void) xocl_peer_listen(lro, xclmgmt_mailbox_srv, (void *)lro);
@@ -771,6 +959,8 @@ static int xclmgmt_probe(struct pci_dev *pdev, const struct pci_device_id *id)
 	xocl_drvinst_set_filedev(lro, lro->user_char_dev.cdev);
 
 	mutex_init(&lro->busy_mutex);
+	mgmt_clk_gov_init(lro);
+	xclmgmt_mailbox_srv_init(lro);
 
 	mgmt_init_sysfs(&pdev->dev);
 
@@ -813,10 +1003,18 @@ static void xclmgmt_remove(struct pci_dev *pdev)
 	BUG_ON(lro->core.pdev != pdev);
 
 	health_thread_stop(lro);
+	mgmt_clk_gov_stop(lro);
 
 	mgmt_fini_sysfs(&pdev->dev);
 
+	/* Let in-flight peer requests finish while subdevs are still around. */
+	if (lro->mbx_srv_wq)
+		flush_workqueue(lro->mbx_srv_wq);
+	if (lro->mbx_serial_wq)
+		flush_workqueue(lro->mbx_serial_wq);
+
 	xocl_subdev_destroy_all(lro);
+	xclmgmt_mailbox_srv_fini(lro);
 
 	xclmgmt_teardown_msix(lro);
 	/* remove user character device */
@@ -18,6 +18,8 @@
 #include <linux/pci.h>
 #include <linux/delay.h>
 #include <linux/time.h>
+#include <linux/workqueue.h>
+#include <linux/rwsem.h>
 #include <linux/types.h>
 #include <asm/io.h>
 #include "../mgmt-reg.h"
@@ -84,6 +86,26 @@ struct xclmgmt_data_buf {
 	char *data_buf;
 };
 
+struct mgmt_clk_gov {
+	struct delayed_work	work;
+	struct list_head	link;
+	unsigned int		samples;
+	unsigned int		busy_samples;
+	/* target waiting for an idle moment to be applied */
+	unsigned short		pending_freq;
+};
+
+/* Number of peer requests the mgmt pf serves concurrently. */
+#define	MGMT_MBX_SRV_WORKERS	4
+
+struct xclmgmt_mbx_work {
+	struct work_struct	work;
+	struct xclmgmt_dev	*lro;
+	u64			msgid;
+	size_t			len;
+	char			data[0];
+};
+
 struct xclmgmt_dev {
 	struct xocl_dev_core	core;
 	/* MAGIC_DEVICE == 0xAAAAAAAA */
@@ -102,11 +124,22 @@ struct xclmgmt_dev {
 	int msix_user_start_vector;
 	bool ready;
 
+	struct mgmt_clk_gov clk_gov;
+
+	/* Peer request servers, see xclmgmt_mailbox_srv(). */
+	struct workqueue_struct *mbx_srv_wq;
+	struct workqueue_struct *mbx_serial_wq;
+	struct rw_semaphore mbx_srv_sem;
+
 };
 
 extern int health_check;
 
 int ocl_freqscaling_ioctl(struct xclmgmt_dev *lro, const void __user *arg);
+void notify_peer_data_changed(struct xclmgmt_dev *lro);
+void mgmt_clk_gov_init(struct xclmgmt_dev *lro);
+void mgmt_clk_gov_start(struct xclmgmt_dev *lro);
+void mgmt_clk_gov_stop(struct xclmgmt_dev *lro);
 void platform_axilite_flush(struct xclmgmt_dev *lro);
 u16 get_dsa_version(struct xclmgmt_dev *lro);
 void fill_frequency_info(struct xclmgmt_dev *lro, struct xclmgmt_ioc_info *obj);
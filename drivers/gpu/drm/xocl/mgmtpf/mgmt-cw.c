@@ -10,6 +10,202 @@
 
 #include "mgmt-core.h"
 
+/*
+ * Data clock governor. KDS lives on the user pf, possibly in another domain,
+ * so utilization is sampled here from the CU control registers and the
+ * temperature from sysmon. Every window the data clock is stepped up while
+ * the CUs are mostly busy, and stepped down while they are mostly idle or
+ * the die runs hot. It never exceeds the frequency set by the xclbin.
+ * Reprogramming the clock wizard isolates the dynamic region, so a new target
+ * is held back until no process on the user pf holds the xclbin lock. With
+ * no lock there is no CU context and no command can be in flight.
+ */
+static int clk_gov_param_set(const char *val, const struct kernel_param *kp);
+
+static const struct kernel_param_ops clk_gov_param_ops = {
+	.set = clk_gov_param_set,
+	.get = param_get_int,
+};
+
+int clk_governor;
+module_param_cb(clk_governor, &clk_gov_param_ops, &clk_governor,
+	(S_IRUGO|S_IWUSR));
+MODULE_PARM_DESC(clk_governor,
+	"Scale data clock with CU utilization (0 = disable, 1 = enable)");
+
+int clk_gov_interval = 100;
+module_param_cb(clk_gov_interval, &clk_gov_param_ops, &clk_gov_interval,
+	(S_IRUGO|S_IWUSR));
+MODULE_PARM_DESC(clk_gov_interval,
+	"Interval between utilization samples in ms (default 100)");
+
+int clk_gov_temp = 80000;
+module_param(clk_gov_temp, int, (S_IRUGO|S_IWUSR));
+MODULE_PARM_DESC(clk_gov_temp,
+	"Temperature above which data clock is stepped down, in mC (default 80000)");
+
+#define	CLK_GOV_WINDOW		10
+#define	CLK_GOV_STEP_MHZ	50
+#define	CLK_GOV_MIN_MHZ		100
+#define	CLK_GOV_UP_PCT		80
+#define	CLK_GOV_DOWN_PCT	20
+
+/* Devices with a governor, so that parameter changes reach every one. */
+static DEFINE_MUTEX(clk_gov_lock);
+static LIST_HEAD(clk_gov_list);
+
+/*
+ * Tell user pf that clocks or xclbin changed underneath it, so it drops
+ * whatever peer data it has cached.
+ */
+void notify_peer_data_changed(struct xclmgmt_dev *lro)
+{
+	struct mailbox_req mbreq = { MAILBOX_REQ_PEER_DATA_CHANGED, };
+
+	(void) xocl_peer_notify(lro, &mbreq, sizeof(struct mailbox_req));
+}
+
+static unsigned short clk_gov_target(struct xclmgmt_dev *lro,
+	unsigned int util)
+{
+	unsigned short cur[4] = { 0 };
+	int hi, lo, target;
+	u32 temp = 0;
+
+	hi = (int)xocl_icap_get_data(lro, DATA_CLK_MAX);
+	if (hi <= 0)
+		return 0;
+	lo = min(CLK_GOV_MIN_MHZ, hi);
+
+	(void) xocl_icap_ocl_get_freq(lro, 0, cur, ARRAY_SIZE(cur));
+	if (!cur[0])
+		return 0;
+
+	/* Sysmon reports whole degrees C, clk_gov_temp is in mC. */
+	xocl_sysmon_get_prop(lro, XOCL_SYSMON_PROP_TEMP, &temp);
+	if (clk_gov_temp > 0 && (int)temp * 1000 > clk_gov_temp)
+		target = cur[0] - CLK_GOV_STEP_MHZ;
+	else if (util >= CLK_GOV_UP_PCT)
+		target = cur[0] + CLK_GOV_STEP_MHZ;
+	else if (util <= CLK_GOV_DOWN_PCT)
+		target = cur[0] - CLK_GOV_STEP_MHZ;
+	else
+		return 0;
+
+	target = clamp(target, lo, hi);
+	return (target == cur[0]) ? 0 : (unsigned short)target;
+}
+
+/* Returns -EBUSY, and leaves the clock alone, while the xclbin is locked. */
+static int clk_gov_apply(struct xclmgmt_dev *lro, unsigned short freq)
+{
+	struct xclmgmt_ioc_freqscaling freq_obj = { 0 };
+	int err;
+
+	freq_obj.ocl_target_freq[0] = freq;
+	err = xocl_icap_ocl_update_clock_freq_idle(lro, &freq_obj);
+	if (err == -EBUSY)
+		return err;
+	if (err) {
+		mgmt_err(lro, "clock governor failed to set %d MHz, err %d",
+			freq, err);
+		return err;
+	}
+	mgmt_info(lro, "clock governor set data clock to %d MHz", freq);
+	notify_peer_data_changed(lro);
+	return 0;
+}
+
+static void clk_gov_work(struct work_struct *work)
+{
+	struct mgmt_clk_gov *gov = container_of(to_delayed_work(work),
+		struct mgmt_clk_gov, work);
+	struct xclmgmt_dev *lro = container_of(gov, struct xclmgmt_dev,
+		clk_gov);
+	unsigned int busy;
+	unsigned short target;
+
+	/* Turned off meanwhile, clk_gov_param_set() restarts it. */
+	if (!clk_governor || clk_gov_interval <= 0)
+		return;
+
+	mutex_lock(&lro->busy_mutex);
+	busy = compute_unit_busy(lro);
+	if (gov->pending_freq && clk_gov_apply(lro, gov->pending_freq) != -EBUSY)
+		gov->pending_freq = 0;
+
+	gov->samples++;
+	if (busy)
+		gov->busy_samples++;
+	if (gov->samples >= CLK_GOV_WINDOW) {
+		target = clk_gov_target(lro,
+			gov->busy_samples * 100 / gov->samples);
+		if (target && clk_gov_apply(lro, target) == -EBUSY)
+			gov->pending_freq = target;
+		gov->samples = gov->busy_samples = 0;
+	}
+	mutex_unlock(&lro->busy_mutex);
+
+	schedule_delayed_work(&gov->work, msecs_to_jiffies(clk_gov_interval));
+}
+
+void mgmt_clk_gov_init(struct xclmgmt_dev *lro)
+{
+	INIT_DELAYED_WORK(&lro->clk_gov.work, clk_gov_work);
+	INIT_LIST_HEAD(&lro->clk_gov.link);
+}
+
+/* Called with clk_gov_lock held. */
+static void clk_gov_update(struct mgmt_clk_gov *gov)
+{
+	if (clk_governor && clk_gov_interval > 0) {
+		schedule_delayed_work(&gov->work, 0);
+		return;
+	}
+
+	cancel_delayed_work_sync(&gov->work);
+	gov->samples = gov->busy_samples = 0;
+	gov->pending_freq = 0;
+}
+
+static int clk_gov_param_set(const char *val, const struct kernel_param *kp)
+{
+	struct mgmt_clk_gov *gov;
+	int ret;
+
+	ret = param_set_int(val, kp);
+	if (ret)
+		return ret;
+
+	mutex_lock(&clk_gov_lock);
+	list_for_each_entry(gov, &clk_gov_list, link)
+		clk_gov_update(gov);
+	mutex_unlock(&clk_gov_lock);
+
+	return 0;
+}
+
+void mgmt_clk_gov_start(struct xclmgmt_dev *lro)
+{
+	lro->clk_gov.samples = lro->clk_gov.busy_samples = 0;
+	lro->clk_gov.pending_freq = 0;
+
+	mutex_lock(&clk_gov_lock);
+	list_add_tail(&lro->clk_gov.link, &clk_gov_list);
+	clk_gov_update(&lro->clk_gov);
+	mutex_unlock(&clk_gov_lock);
+}
+
+void mgmt_clk_gov_stop(struct xclmgmt_dev *lro)
+{
+	mutex_lock(&clk_gov_lock);
+	if (!list_empty(&lro->clk_gov.link))
+		list_del_init(&lro->clk_gov.link);
+	mutex_unlock(&clk_gov_lock);
+
+	cancel_delayed_work_sync(&lro->clk_gov.work);
+}
+
 int ocl_freqscaling_ioctl(struct xclmgmt_dev *lro, const void __user *arg)
 {
 	struct xclmgmt_ioc_freqscaling freq_obj;
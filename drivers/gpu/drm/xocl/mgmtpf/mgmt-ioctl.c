@@ -62,32 +62,29 @@ static long reset_ocl_ioctl(struct xclmgmt_dev *lro)
 	return compute_unit_busy(lro) ? -EBUSY : 0;
 }
 
-static int bitstream_ioctl_axlf(struct xclmgmt_dev *lro, const void __user *arg)
+static int bitstream_ioctl_axlf(struct xclmgmt_dev *lro, const void __user *arg,
+	bool stage)
 {
-	void *copy_buffer = NULL;
-	size_t copy_buffer_size = 0;
+	struct axlf *xclbin = NULL;
+	size_t len = 0;
+	s64 copy_us = 0;
 	struct xclmgmt_ioc_bitstream_axlf ioc_obj = { 0 };
-	struct axlf xclbin_obj = { 0 };
 	int ret = 0;
 
 	if (copy_from_user((void *)&ioc_obj, arg, sizeof(ioc_obj)))
 		return -EFAULT;
-	if (copy_from_user((void *)&xclbin_obj, ioc_obj.xclbin,
-		sizeof(xclbin_obj)))
-		return -EFAULT;
 
-	copy_buffer_size = xclbin_obj.m_header.m_length;
-	copy_buffer = vmalloc(copy_buffer_size);
-	if (copy_buffer == NULL)
-		return -ENOMEM;
+	ret = xocl_axlf_copy_from_user(lro, ioc_obj.xclbin, &xclbin, &len,
+		&copy_us);
+	if (ret)
+		return ret;
 
-	if (copy_from_user((void *)copy_buffer, ioc_obj.xclbin,
-		copy_buffer_size))
-		ret = -EFAULT;
+	if (stage)
+		ret = xocl_icap_stage_axlf(lro, xclbin, len);
 	else
-		ret = xocl_icap_download_axlf(lro, copy_buffer);
+		ret = xocl_icap_download_axlf(lro, xclbin, len, copy_us);
 
-	vfree(copy_buffer);
+	vfree(xclbin);
 	return ret;
 }
 
@@ -121,7 +118,17 @@ long mgmt_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 		result = -EINVAL;
 		break;
 	case XCLMGMT_IOCICAPDOWNLOAD_AXLF:
-		result = bitstream_ioctl_axlf(lro, (void __user *)arg);
+		result = bitstream_ioctl_axlf(lro, (void __user *)arg, false);
+		if (!result)
+			notify_peer_data_changed(lro);
+		break;
+	case XCLMGMT_IOCICAPSTAGE_AXLF:
+		result = bitstream_ioctl_axlf(lro, (void __user *)arg, true);
+		break;
+	case XCLMGMT_IOCICAPCOMMIT_AXLF:
+		result = xocl_icap_commit_axlf(lro);
+		if (!result)
+			notify_peer_data_changed(lro);
 		break;
 	case XCLMGMT_IOCOCLRESET:
 		result = reset_ocl_ioctl(lro);
@@ -131,6 +138,8 @@ long mgmt_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 		break;
 	case XCLMGMT_IOCFREQSCALE:
 		result = ocl_freqscaling_ioctl(lro, (void __user *)arg);
+		if (!result)
+			notify_peer_data_changed(lro);
 		break;
 	case XCLMGMT_IOCREBOOT:
 		result = capable(CAP_SYS_ADMIN) ? pci_fundamental_reset(lro) : -EACCES;
@@ -164,6 +164,15 @@ static ssize_t mig_calibration_show(struct device *dev,
 }
 static DEVICE_ATTR_RO(mig_calibration);
 
+static ssize_t subdev_probe_time_show(struct device *dev,
+	struct device_attribute *attr, char *buf)
+{
+	struct xclmgmt_dev *lro = dev_get_drvdata(dev);
+
+	return xocl_subdev_probe_report(lro, buf);
+}
+static DEVICE_ATTR_RO(subdev_probe_time);
+
 static ssize_t xpr_show(struct device *dev,
 	struct device_attribute *attr, char *buf)
 {
@@ -271,6 +280,77 @@ static ssize_t subdev_offline_store(struct device *dev,
 
 static DEVICE_ATTR(subdev_offline, 0200, NULL, subdev_offline_store);
 
+/*
+ * Every XMC, sysmon, firewall and MIG ECC value in one fixed, versioned
+ * struct, so that exporters need one read per card instead of one per file.
+ */
+static ssize_t read_sensor_dump(struct file *filp, struct kobject *kobj,
+	struct bin_attribute *attr, char *buffer, loff_t offset, size_t count)
+{
+	struct xclmgmt_dev *lro = dev_get_drvdata(container_of(kobj,
+		struct device, kobj));
+	struct xclmgmt_sensor_dump *dump;
+	size_t size = sizeof(*dump);
+	int level = -1;
+	u32 i;
+
+	BUILD_BUG_ON(sizeof(dump->xmc) != XOCL_XMC_SENSOR_BLOCK_SZ);
+	BUILD_BUG_ON(ARRAY_SIZE(dump->sysmon) !=
+		XOCL_SYSMON_PROP_VCC_BRAM_MIN + 1);
+
+	if (offset >= size)
+		return 0;
+	if (count > size - offset)
+		count = size - offset;
+
+	dump = kzalloc(size, GFP_KERNEL);
+	if (!dump)
+		return -ENOMEM;
+
+	dump->version = XCLMGMT_SENSOR_DUMP_VERSION;
+	dump->size = size;
+	dump->ts_ns = ktime_get_ns();
+
+	/* The whole XMC block is read under one xmc_lock acquisition. */
+	dump->xmc_valid = xocl_xmc_get_sensors(lro, dump->xmc,
+		sizeof(dump->xmc)) == 0;
+	for (i = 0; i < ARRAY_SIZE(dump->sysmon); i++)
+		(void) xocl_sysmon_get_prop(lro, i, &dump->sysmon[i]);
+
+	(void) xocl_af_get_prop(lro, XOCL_AF_PROP_STATUS, &dump->af_status);
+	(void) xocl_af_get_prop(lro, XOCL_AF_PROP_LEVEL, &level);
+	dump->af_level = level;
+	(void) xocl_af_get_prop(lro, XOCL_AF_PROP_DETECTED_STATUS,
+		&dump->af_detected_status);
+	(void) xocl_af_get_prop(lro, XOCL_AF_PROP_DETECTED_LEVEL,
+		&dump->af_detected_level);
+	(void) xocl_af_get_prop(lro, XOCL_AF_PROP_DETECTED_TIME,
+		&dump->af_detected_time);
+
+	dump->mig_count = xocl_mig_get_ecc(lro, dump->mig,
+		ARRAY_SIZE(dump->mig));
+
+	memcpy(buffer, (char *)dump + offset, count);
+	kfree(dump);
+
+	return count;
+}
+
+static struct bin_attribute bin_sensor_dump_attr = {
+	.attr = {
+		.name = "sensor_dump",
+		.mode = 0444
+	},
+	.read = read_sensor_dump,
+	.write = NULL,
+	.size = sizeof(struct xclmgmt_sensor_dump)
+};
+
+static struct bin_attribute *mgmt_bin_attrs[] = {
+	&bin_sensor_dump_attr,
+	NULL,
+};
+
 static struct attribute *mgmt_attrs[] = {
 	&dev_attr_instance.attr,
 	&dev_attr_error.attr,
@@ -292,11 +372,13 @@ static struct attribute *mgmt_attrs[] = {
 	&dev_attr_dev_offline.attr,
 	&dev_attr_subdev_online.attr,
 	&dev_attr_subdev_offline.attr,
+	&dev_attr_subdev_probe_time.attr,
 	NULL,
 };
 
 static struct attribute_group mgmt_attr_group = {
 	.attrs = mgmt_attrs,
+	.bin_attrs = mgmt_bin_attrs,
 };
 
 int mgmt_init_sysfs(struct device *dev)
@@ -19,6 +19,7 @@
 #include <linux/platform_device.h>
 #include <linux/hwmon-sysfs.h>
 #include <linux/rtc.h>
+#include <linux/seqlock.h>
 #include "../xocl_drv.h"
 
 /* Firewall registers */
@@ -58,10 +59,13 @@ extern struct timezone sys_tz;
 #define	MAX_LEVEL		16
 
 struct firewall {
+	struct platform_device	*pdev;
 	void __iomem		*base_addrs[MAX_LEVEL];
 	u32			max_level;
 	void __iomem		*gpio_addr;
 
+	/* Protects the trip status below, written by check_firewall(). */
+	seqlock_t		status_lock;
 	u32			curr_status;
 	int			curr_level;
 
@@ -70,6 +74,17 @@ struct firewall {
 	u64			err_detected_time;
 
 	bool			inject_firewall;
+
+	/*
+	 * Trip interrupt, only when the shell wires the firewall trip output
+	 * to a user MSI-X vector. Otherwise irq is -1 and trips are found by
+	 * the health thread polling the status registers. The vector is masked
+	 * from a trip until the firewall is cleared; the health thread polls
+	 * and keeps notifying the peer for that long.
+	 */
+	int			irq;
+	bool			intr_masked;
+	struct work_struct	trip_work;
 };
 
 static int clear_firewall(struct platform_device *pdev);
@@ -78,36 +93,70 @@ static u32 check_firewall(struct platform_device *pdev, int *level);
 static int get_prop(struct platform_device *pdev, u32 prop, void *val)
 {
 	struct firewall *fw;
+	unsigned int seq;
+	int ret = 0;
 
 	fw = platform_get_drvdata(pdev);
 	BUG_ON(!fw);
 
 	check_firewall(pdev, NULL);
-	switch (prop) {
-	case XOCL_AF_PROP_TOTAL_LEVEL:
-		*(u32 *)val = fw->max_level;
-		break;
-	case XOCL_AF_PROP_STATUS:
-		*(u32 *)val = fw->curr_status;
-		break;
-	case XOCL_AF_PROP_LEVEL:
-		*(int *)val = fw->curr_level;
-		break;
-	case XOCL_AF_PROP_DETECTED_STATUS:
-		*(u32 *)val = fw->err_detected_status;
-		break;
-	case XOCL_AF_PROP_DETECTED_LEVEL:
-		*(u32 *)val = fw->err_detected_level;
-		break;
-	case XOCL_AF_PROP_DETECTED_TIME:
-		*(u64 *)val = fw->err_detected_time;
-		break;
-	default:
+	do {
+		seq = read_seqbegin(&fw->status_lock);
+		switch (prop) {
+		case XOCL_AF_PROP_TOTAL_LEVEL:
+			*(u32 *)val = fw->max_level;
+			break;
+		case XOCL_AF_PROP_STATUS:
+			*(u32 *)val = fw->curr_status;
+			break;
+		case XOCL_AF_PROP_LEVEL:
+			*(int *)val = fw->curr_level;
+			break;
+		case XOCL_AF_PROP_DETECTED_STATUS:
+			*(u32 *)val = fw->err_detected_status;
+			break;
+		case XOCL_AF_PROP_DETECTED_LEVEL:
+			*(u32 *)val = fw->err_detected_level;
+			break;
+		case XOCL_AF_PROP_DETECTED_TIME:
+			*(u64 *)val = fw->err_detected_time;
+			break;
+		default:
+			ret = -EINVAL;
+			break;
+		}
+	} while (read_seqretry(&fw->status_lock, seq));
+
+	if (ret)
 		xocl_err(&pdev->dev, "Invalid prop %d", prop);
-		return -EINVAL;
-	}
 
-	return 0;
+	return ret;
+}
+
+/*
+ * Last published trip status, no register access. Safe to call from any
+ * context without the caller's locks.
+ */
+static u32 get_status(struct platform_device *pdev, int *level)
+{
+	struct firewall *fw;
+	unsigned int seq;
+	u32 status;
+	int lvl;
+
+	fw = platform_get_drvdata(pdev);
+	BUG_ON(!fw);
+
+	do {
+		seq = read_seqbegin(&fw->status_lock);
+		status = fw->curr_status;
+		lvl = fw->curr_level;
+	} while (read_seqretry(&fw->status_lock, seq));
+
+	if (level && status)
+		*level = lvl;
+
+	return status;
 }
 
 /* sysfs support */
@@ -189,39 +238,47 @@ static const struct attribute_group firewall_attrgroup = {
 	.attrs = firewall_attributes,
 };
 
+/*
+ * Sweep the status registers without holding any lock, then publish the
+ * result under status_lock so readers always see a consistent snapshot.
+ * The sweep may race with a hot reset; a register reading all-ones means
+ * the bus is down, so nothing is recorded for that pass.
+ */
 static u32 check_firewall(struct platform_device *pdev, int *level)
 {
 	struct firewall	*fw;
-//	struct timeval	time;
 	struct timespec64 now;
 	int	i;
 	u32	val = 0;
+	u32	status;
 
 	fw = platform_get_drvdata(pdev);
 	BUG_ON(!fw);
 
 	for (i = 0; i < fw->max_level; i++) {
-		val = IS_FIRED(fw, i);
+		val = READ_STATUS(fw, i);
+		if (val == ~0U) {
+			xocl_dbg(&pdev->dev, "AXI Firewall %d not readable", i);
+			return 0;
+		}
+		val &= ~FIREWALL_STATUS_BUSY;
 		if (val) {
 			xocl_info(&pdev->dev, "AXI Firewall %d tripped, "
 				"status: 0x%x", i, val);
-			if (!fw->curr_status) {
-				fw->err_detected_status = val;
-				fw->err_detected_level = i;
-				ktime_get_ts64(&now);
-// PORT4_20
-//				do_gettimeofday(&time);
-				fw->err_detected_time = (u64)(now.tv_sec -
-					(sys_tz.tz_minuteswest * 60));
-			}
-			fw->curr_level = i;
-
-			if (level)
-				*level = i;
 			break;
 		}
 	}
 
+	ktime_get_ts64(&now);
+
+	write_seqlock(&fw->status_lock);
+	if (val && !fw->curr_status) {
+		fw->err_detected_status = val;
+		fw->err_detected_level = i;
+		fw->err_detected_time = (u64)(now.tv_sec -
+			(sys_tz.tz_minuteswest * 60));
+	}
+
 	fw->curr_status = val;
 	fw->curr_level = i >= fw->max_level ? -1 : i;
 
@@ -232,7 +289,12 @@ static u32 check_firewall(struct platform_device *pdev, int *level)
 		fw->curr_status = 0x1;
 	}
 
-	return fw->curr_status;
+	status = fw->curr_status;
+	if (level && status)
+		*level = fw->curr_level;
+	write_sequnlock(&fw->status_lock);
+
+	return status;
 }
 
 static int clear_firewall(struct platform_device *pdev)
@@ -247,7 +309,7 @@ static int clear_firewall(struct platform_device *pdev)
 
 	if (!check_firewall(pdev, NULL)) {
 		/* firewall is not tripped */
-		return 0;
+		goto done;
 	}
 
 retry_level1:
@@ -273,7 +335,7 @@ static int clear_firewall(struct platform_device *pdev)
 
 	if (!check_firewall(pdev, NULL)) {
 		xocl_info(&pdev->dev, "firewall cleared level 1");
-		return 0;
+		goto done;
 	}
 
 	clear_retry = 0;
@@ -288,7 +350,7 @@ static int clear_firewall(struct platform_device *pdev)
 
 	if (!check_firewall(pdev, NULL)) {
 		xocl_info(&pdev->dev, "firewall cleared level 2");
-		return 0;
+		goto done;
 	}
 
 	xocl_info(&pdev->dev, "failed clear firewall, level %d, status 0x%x",
@@ -298,14 +360,100 @@ static int clear_firewall(struct platform_device *pdev)
 
 failed:
 	return ret;
+
+done:
+	/* Re-arm the trip vector masked by firewall_isr(). */
+	if (fw->irq != -1 && READ_ONCE(fw->intr_masked)) {
+		(void) xocl_user_interrupt_config(xocl_get_xdev(pdev),
+			fw->irq, true);
+		WRITE_ONCE(fw->intr_masked, false);
+	}
+	return 0;
+}
+
+static bool intr_enabled(struct platform_device *pdev)
+{
+	struct firewall *fw = platform_get_drvdata(pdev);
+
+	return fw && fw->irq != -1 && !READ_ONCE(fw->intr_masked);
 }
 
 static struct xocl_firewall_funcs fw_ops = {
 	.clear_firewall	= clear_firewall,
 	.check_firewall = check_firewall,
 	.get_prop = get_prop,
+	.intr_enabled = intr_enabled,
+	.get_status = get_status,
 };
 
+/*
+ * The trip vector stays masked from the time it fires until the firewall is
+ * cleared, the status is sticky and would otherwise keep interrupting.
+ */
+static irqreturn_t firewall_isr(int irq, void *arg)
+{
+	struct firewall *fw = (struct firewall *)arg;
+
+	(void) xocl_user_interrupt_config(xocl_get_xdev(fw->pdev),
+		fw->irq, false);
+	WRITE_ONCE(fw->intr_masked, true);
+	schedule_work(&fw->trip_work);
+
+	return IRQ_HANDLED;
+}
+
+static void firewall_trip_work(struct work_struct *work)
+{
+	struct firewall *fw = container_of(work, struct firewall, trip_work);
+	struct mailbox_req mbreq = { MAILBOX_REQ_FIREWALL, };
+	xdev_handle_t xdev = xocl_get_xdev(fw->pdev);
+
+	if (!check_firewall(fw->pdev, NULL)) {
+		/* Cleared before we got here, nothing to report. */
+		(void) xocl_user_interrupt_config(xdev, fw->irq, true);
+		WRITE_ONCE(fw->intr_masked, false);
+		return;
+	}
+
+	xocl_info(&fw->pdev->dev, "firewall trip interrupt, notify peer");
+	(void) xocl_peer_notify(xdev, &mbreq, sizeof(struct mailbox_req));
+}
+
+static void firewall_enable_intr(struct firewall *fw)
+{
+	struct platform_device *pdev = fw->pdev;
+	xdev_handle_t xdev = xocl_get_xdev(pdev);
+	struct resource *res;
+	int ret;
+
+	res = platform_get_resource(pdev, IORESOURCE_IRQ, 0);
+	if (!res) {
+		xocl_info(&pdev->dev, "no trip intr, polling firewall status");
+		return;
+	}
+
+	ret = xocl_user_interrupt_reg(xdev, res->start, firewall_isr, fw);
+	if (ret) {
+		xocl_err(&pdev->dev, "failed to add intr handler: %d", ret);
+		return;
+	}
+	fw->irq = res->start;
+	(void) xocl_user_interrupt_config(xdev, fw->irq, true);
+}
+
+static void firewall_disable_intr(struct firewall *fw)
+{
+	xdev_handle_t xdev = xocl_get_xdev(fw->pdev);
+
+	if (fw->irq == -1)
+		return;
+
+	(void) xocl_user_interrupt_config(xdev, fw->irq, false);
+	(void) xocl_user_interrupt_reg(xdev, fw->irq, NULL, fw);
+	cancel_work_sync(&fw->trip_work);
+	fw->irq = -1;
+}
+
 static int firewall_remove(struct platform_device *pdev)
 {
 	struct firewall *fw;
@@ -317,6 +465,8 @@ static int firewall_remove(struct platform_device *pdev)
 		return -EINVAL;
 	}
 
+	firewall_disable_intr(fw);
+
 	sysfs_remove_group(&pdev->dev.kobj, &firewall_attrgroup);
 
 	for (i = 0; i <= fw->max_level; i++) {
@@ -345,6 +495,10 @@ static int firewall_probe(struct platform_device *pdev)
 	platform_set_drvdata(pdev, fw);
 
 	fw->curr_level = -1;
+	fw->pdev = pdev;
+	fw->irq = -1;
+	seqlock_init(&fw->status_lock);
+	INIT_WORK(&fw->trip_work, firewall_trip_work);
 
 	for (i = 0; i < MAX_LEVEL; i++) {
 		res = platform_get_resource(pdev, IORESOURCE_MEM, i);
@@ -370,6 +524,8 @@ static int firewall_probe(struct platform_device *pdev)
 
 	xocl_subdev_register(pdev, XOCL_SUBDEV_AF, &fw_ops);
 
+	firewall_enable_intr(fw);
+
 	return 0;
 
 failed:
@@ -106,7 +106,7 @@ static int xocl_pr_write_complete(struct fpga_manager *mgr,
 		return -EINVAL;
 	}
 	/* Send the xclbin blob to actual download framework in icap */
-	result = xocl_icap_download_axlf(obj->xdev, obj->blob);
+	result = xocl_icap_download_axlf(obj->xdev, obj->blob, obj->count, 0);
 	obj->state = result ? FPGA_MGR_STATE_WRITE_COMPLETE_ERR : FPGA_MGR_STATE_WRITE_COMPLETE;
 	xocl_info(&mgr->dev, "Finish download of xclbin %pUb of size %zu B", &obj->blob->m_header.uuid, obj->count);
 	vfree(obj->blob);
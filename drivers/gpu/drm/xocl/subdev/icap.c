@@ -30,6 +30,7 @@
 #include <linux/version.h>
 #include <linux/uuid.h>
 #include <linux/pid.h>
+#include <linux/ktime.h>
 #include "../xclbin.h"
 #include "../xocl_drv.h"
 #include <drm/xmgmt_drm.h>
@@ -47,6 +48,11 @@ static uuid_t uuid_null = NULL_UUID_LE;
 
 #define	ICAP_PRIVILEGED(icap)	((icap)->icap_regs != NULL)
 #define DMA_HWICAP_BITFILE_BUFFER_SIZE 1024
+#define	ICAP_WRITE_FAST_POLL		20
+#define	ICAP_WRITE_TIMEOUT_US		1000
+#define	MIG_CALIB_POLL_MIN_US		100
+#define	MIG_CALIB_POLL_MAX_US		20000
+#define	MIG_CALIB_TIMEOUT_MS		5000
 #define	ICAP_MAX_REG_GROUPS		ARRAY_SIZE(XOCL_RES_ICAP_MGMT)
 
 #define	ICAP_MAX_NUM_CLOCKS		2
@@ -116,6 +122,34 @@ struct icap_bitstream_user {
 	pid_t			ibu_pid;
 };
 
+/*
+ * Where the time of an xclbin load went. Phases that do not apply to a pf,
+ * e.g. peer on mgmt or program on user, stay 0. Total covers the icap
+ * download path only, copy is reported separately.
+ */
+enum icap_load_phase {
+	ICAP_PHASE_COPY,
+	ICAP_PHASE_PEER,
+	ICAP_PHASE_CLOCK,
+	ICAP_PHASE_FREEZE,
+	ICAP_PHASE_PROGRAM,
+	ICAP_PHASE_CALIB,
+	ICAP_PHASE_TOTAL,
+	ICAP_PHASE_NUM
+};
+
+static const char * const icap_phase_names[ICAP_PHASE_NUM] = {
+	"copy", "peer", "clock", "freeze", "program", "calib", "total"
+};
+
+#define	ICAP_LOAD_HISTORY	8
+
+struct icap_load_stat {
+	uuid_t			uuid;
+	int			err;
+	s64			phase_us[ICAP_PHASE_NUM];
+};
+
 struct icap {
 	struct platform_device	*icap_pdev;
 	struct mutex		icap_lock;
@@ -147,6 +181,23 @@ struct icap {
 
 	char			*bit_buffer;
 	unsigned long		bit_length;
+
+	struct axlf		*icap_staged_xclbin;
+	size_t			icap_staged_len;
+
+	/*
+	 * Peer data cached on user pf, one valid bit per data_kind. Dropped
+	 * on xclbin download, reclock and peer notification.
+	 */
+	u64			icap_peer_cache_valid;
+	u32			icap_peer_ocl_frequency[ICAP_MAX_NUM_CLOCKS];
+	u32			icap_peer_freq_counter[ICAP_MAX_NUM_CLOCKS];
+	u32			icap_peer_idcode;
+
+	/* Last ICAP_LOAD_HISTORY loads, icap_load_count is the next slot. */
+	struct icap_load_stat	icap_load_hist[ICAP_LOAD_HISTORY];
+	u32			icap_load_count;
+	u32			icap_load_skipped;
 };
 
 static inline u32 reg_rd(void __iomem *reg)
@@ -214,10 +265,20 @@ const static struct xclmgmt_ocl_clockwiz {
 	{/*1000*/  500, 0x0a01, 0x0002}
 };
 
+/*
+ * Section table of one xclbin, indexed by kind. Built once per load by
+ * icap_index_axlf(), which is also where all section bounds are checked.
+ */
+#define	ICAP_AXLF_MAX_KIND	(BITSTREAM_PARTIAL_PDI + 1)
+struct axlf_sect_index {
+	const struct axlf			*top;
+	const struct axlf_section_header	*hdr[ICAP_AXLF_MAX_KIND];
+};
+
 static int icap_verify_bitstream_axlf(struct platform_device *pdev,
-	struct axlf *xclbin);
+	const struct axlf_sect_index *idx);
 static int icap_parse_bitstream_axlf_section(struct platform_device *pdev,
-	const struct axlf *xclbin, enum axlf_section_kind kind);
+	const struct axlf_sect_index *idx, enum axlf_section_kind kind);
 
 static struct icap_bitstream_user *alloc_user(pid_t pid)
 {
@@ -249,26 +310,82 @@ static struct icap_bitstream_user *obtain_user(struct icap *icap, pid_t pid)
 	return NULL;
 }
 
-static void icap_read_from_peer(struct platform_device *pdev, enum data_kind kind, void *resp, size_t resplen)
+static int icap_read_from_peer(struct platform_device *pdev, enum data_kind kind, void *resp, size_t resplen)
 {
 	struct mailbox_subdev_peer subdev_peer = {0};
 	size_t data_len = sizeof(struct mailbox_subdev_peer);
 	struct mailbox_req *mb_req = NULL;
 	size_t reqlen = sizeof(struct mailbox_req) + data_len;
+	int ret;
 
 	mb_req = (struct mailbox_req *)vmalloc(reqlen);
 	if (!mb_req)
-		return;
+		return -ENOMEM;
 
 	mb_req->req = MAILBOX_REQ_PEER_DATA;
 
 	subdev_peer.kind = kind;
 	memcpy(mb_req->data, &subdev_peer, data_len);
 
-	(void) xocl_peer_request(XOCL_PL_DEV_TO_XDEV(pdev),
+	ret = xocl_peer_request(XOCL_PL_DEV_TO_XDEV(pdev),
 		mb_req, reqlen, resp, &resplen, NULL, NULL);
 
 	vfree(mb_req);
+	return ret;
+}
+
+static void *icap_peer_cache_slot(struct icap *icap, enum data_kind kind,
+	size_t *len)
+{
+	*len = sizeof(u32);
+
+	switch (kind) {
+	case CLOCK_FREQ_0:
+	case CLOCK_FREQ_1:
+		return &icap->icap_peer_ocl_frequency[kind - CLOCK_FREQ_0];
+	case FREQ_COUNTER_0:
+	case FREQ_COUNTER_1:
+		return &icap->icap_peer_freq_counter[kind - FREQ_COUNTER_0];
+	case IDCODE:
+		return &icap->icap_peer_idcode;
+	default:
+		break;
+	}
+
+	return NULL;
+}
+
+/*
+ * Same as icap_read_from_peer(), but serve repeated reads from the local
+ * cache. Should be called with icap_lock held.
+ */
+static void icap_read_from_peer_cached(struct icap *icap, enum data_kind kind,
+	void *resp, size_t resplen)
+{
+	size_t len;
+	void *slot = icap_peer_cache_slot(icap, kind, &len);
+
+	if (!slot || len != resplen) {
+		(void) icap_read_from_peer(icap->icap_pdev, kind, resp, resplen);
+		return;
+	}
+
+	if (!(icap->icap_peer_cache_valid & BIT_ULL(kind))) {
+		if (icap_read_from_peer(icap->icap_pdev, kind, slot, len))
+			return;
+		icap->icap_peer_cache_valid |= BIT_ULL(kind);
+	}
+
+	memcpy(resp, slot, len);
+}
+
+static void icap_peer_cache_invalidate(struct platform_device *pdev)
+{
+	struct icap *icap = platform_get_drvdata(pdev);
+
+	mutex_lock(&icap->icap_lock);
+	icap->icap_peer_cache_valid = 0;
+	mutex_unlock(&icap->icap_lock);
 }
 
 
@@ -348,7 +465,7 @@ static unsigned find_matching_freq_config(unsigned freq)
 	return idx;
 }
 
-static unsigned short icap_get_ocl_frequency(const struct icap *icap, int idx)
+static unsigned short icap_get_ocl_frequency(struct icap *icap, int idx)
 {
 #define XCL_INPUT_FREQ 100
 	const u64 input = XCL_INPUT_FREQ;
@@ -406,12 +523,15 @@ static unsigned short icap_get_ocl_frequency(const struct icap *icap, int idx)
 		}
 		freq = (input * mul0) / div0;
 	} else {
-		icap_read_from_peer(icap->icap_pdev, CLOCK_FREQ_0, (u32 *)&freq, sizeof(u32));
+		val = 0;
+		icap_read_from_peer_cached(icap, CLOCK_FREQ_0 + idx, &val,
+			sizeof(u32));
+		freq = val;
 	}
 	return freq;
 }
 
-static unsigned int icap_get_clock_frequency_counter_khz(const struct icap *icap, int idx)
+static unsigned int icap_get_clock_frequency_counter_khz(struct icap *icap, int idx)
 {
 	u32 freq, status;
 	char *base = icap->icap_clock_freq_counter;
@@ -439,7 +559,8 @@ static unsigned int icap_get_clock_frequency_counter_khz(const struct icap *icap
 
 	  freq = reg_rd(base + OCL_CLK_FREQ_COUNTER_OFFSET + idx * sizeof(u32));
 	} else {
-		icap_read_from_peer(icap->icap_pdev, FREQ_COUNTER_0, (u32 *)&freq, sizeof(u32));
+		icap_read_from_peer_cached(icap, FREQ_COUNTER_0 + idx, &freq,
+			sizeof(u32));
 	}
   return freq;
 }
@@ -761,15 +882,14 @@ static int icap_ocl_set_freqscaling(struct platform_device *pdev,
 	return err;
 }
 
-static int icap_ocl_update_clock_freq_topology(struct platform_device *pdev, struct xclmgmt_ioc_freqscaling *freq_obj)
+static int __icap_update_clock_freq(struct icap *icap,
+	struct xclmgmt_ioc_freqscaling *freq_obj)
 {
-	struct icap *icap = platform_get_drvdata(pdev);
 	struct clock_freq_topology *topology = 0;
 	int num_clocks = 0;
 	int i = 0;
 	int err = 0;
 
-	mutex_lock(&icap->icap_lock);
 	if (icap->icap_clock_freq_topology) {
 		topology = (struct clock_freq_topology *)icap->icap_clock_freq_topology;
 		num_clocks = topology->m_count;
@@ -800,6 +920,36 @@ static int icap_ocl_update_clock_freq_topology(struct platform_device *pdev, str
 	err = set_and_verify_freqs(icap, freq_obj->ocl_target_freq, ARRAY_SIZE(freq_obj->ocl_target_freq));
 
 done:
+	return err;
+}
+
+static int icap_ocl_update_clock_freq_topology(struct platform_device *pdev, struct xclmgmt_ioc_freqscaling *freq_obj)
+{
+	struct icap *icap = platform_get_drvdata(pdev);
+	int err;
+
+	mutex_lock(&icap->icap_lock);
+	err = __icap_update_clock_freq(icap, freq_obj);
+	mutex_unlock(&icap->icap_lock);
+	return err;
+}
+
+/*
+ * Reclock only while no process holds the xclbin. Without a lock there is
+ * no context on any CU, so no command can be in flight when the AXI gate
+ * is frozen, and holding icap_lock keeps new lockers out until done.
+ */
+static int icap_ocl_update_clock_freq_idle(struct platform_device *pdev,
+	struct xclmgmt_ioc_freqscaling *freq_obj)
+{
+	struct icap *icap = platform_get_drvdata(pdev);
+	int err;
+
+	mutex_lock(&icap->icap_lock);
+	if (icap_bitstream_in_use(icap, 0))
+		err = -EBUSY;
+	else
+		err = __icap_update_clock_freq(icap, freq_obj);
 	mutex_unlock(&icap->icap_lock);
 	return err;
 }
@@ -827,18 +977,79 @@ static inline bool mig_calibration_done(struct icap *icap)
 	return (reg_rd(&icap->icap_state->igs_state) & BIT(0)) != 0;
 }
 
-/* Check for MIG calibration. */
-static int calibrate_mig(struct icap *icap)
+static inline bool mig_bank_in_use(const struct mem_data *mem)
 {
-	int i;
+	return mem->m_used && (mem->m_type == MEM_DDR3 ||
+		mem->m_type == MEM_DDR4 || mem->m_type == MEM_DRAM);
+}
 
-	for (i = 0; i < 10 && !mig_calibration_done(icap); ++i)
-		msleep(500);
+/*
+ * Return the MEM_TOPOLOGY of the xclbin being loaded, or NULL if it has none
+ * or the section is truncated.
+ */
+static const struct mem_topology *axlf_mem_topology(
+	const struct axlf_sect_index *idx)
+{
+	const struct axlf_section_header *hdr = idx->hdr[MEM_TOPOLOGY];
+	const struct mem_topology *topo;
 
-	if (!mig_calibration_done(icap)) {
-		ICAP_ERR(icap,
-			"MIG calibration timeout after bitstream download");
-		return -ETIMEDOUT;
+	if (!hdr || hdr->m_sectionSize < offsetof(struct mem_topology,
+		m_mem_data))
+		return NULL;
+
+	topo = (const struct mem_topology *)
+		((const char *)idx->top + hdr->m_sectionOffset);
+	if (topo->m_count < 0 || offsetof(struct mem_topology, m_mem_data) +
+		(uint64_t)topo->m_count * sizeof(struct mem_data) >
+		hdr->m_sectionSize)
+		return NULL;
+
+	return topo;
+}
+
+/*
+ * Check for MIG calibration. The status register only carries one bit for
+ * all memory controllers, so the time it takes is reported against each
+ * bank the new xclbin uses. If none of its DDR banks are in use, there is
+ * nothing to wait for.
+ */
+static int calibrate_mig(struct icap *icap, const struct axlf_sect_index *idx)
+{
+	const struct mem_topology *topo = axlf_mem_topology(idx);
+	unsigned long delay = MIG_CALIB_POLL_MIN_US;
+	ktime_t start = ktime_get();
+	s64 elapsed;
+	int i, used = 0;
+
+	if (topo) {
+		for (i = 0; i < topo->m_count; i++)
+			used += mig_bank_in_use(&topo->m_mem_data[i]);
+		if (!used) {
+			ICAP_INFO(icap, "no DDR bank in use, skip MIG calibration");
+			return 0;
+		}
+	}
+
+	while (!mig_calibration_done(icap)) {
+		if (ktime_ms_delta(ktime_get(), start) > MIG_CALIB_TIMEOUT_MS) {
+			ICAP_ERR(icap,
+				"MIG calibration timeout after bitstream download");
+			return -ETIMEDOUT;
+		}
+		usleep_range(delay, delay + delay / 2);
+		delay = min(delay * 2, (unsigned long)MIG_CALIB_POLL_MAX_US);
+	}
+	elapsed = ktime_us_delta(ktime_get(), start);
+
+	if (!topo) {
+		ICAP_INFO(icap, "MIG calibration done in %lld us", elapsed);
+		return 0;
+	}
+	for (i = 0; i < topo->m_count; i++) {
+		if (!mig_bank_in_use(&topo->m_mem_data[i]))
+			continue;
+		ICAP_INFO(icap, "MIG calibration of %.16s done in %lld us",
+			topo->m_mem_data[i].m_tag, elapsed);
 	}
 
 	return 0;
@@ -900,17 +1111,23 @@ static int wait_for_done(struct icap *icap)
 	int i = 0;
 
 	for (i = 0; i < 10; i++) {
-		udelay(5);
 		w = reg_rd(&icap->icap_regs->ir_sr);
-		ICAP_INFO(icap, "XHWICAP_SR: %x", w);
+		ICAP_DBG(icap, "XHWICAP_SR: %x", w);
 		if (w & 0x5)
 			return 0;
+		udelay(5);
 	}
 
 	ICAP_ERR(icap, "bitstream download timeout");
 	return -ETIMEDOUT;
 }
 
+/*
+ * Push one burst into the write FIFO and kick the controller once. The
+ * FIFO drains one dword per ICAP clock, so a full burst takes a few
+ * microseconds; spin briefly on the done bit and fall back to udelay()
+ * for the tail instead of failing after a fixed 1us window.
+ */
 static int icap_write(struct icap *icap, const u32 *word_buf, int size)
 {
 	int i;
@@ -923,11 +1140,14 @@ static int icap_write(struct icap *icap, const u32 *word_buf, int size)
 
 	reg_wr(&icap->icap_regs->ir_cr, 0x1);
 
-	for (i = 0; i < 20; i++) {
+	for (i = 0; i < ICAP_WRITE_FAST_POLL + ICAP_WRITE_TIMEOUT_US; i++) {
 		value = reg_rd(&icap->icap_regs->ir_cr);
 		if ((value & 0x1) == 0)
 			return 0;
-		ndelay(50);
+		if (i < ICAP_WRITE_FAST_POLL)
+			ndelay(50);
+		else
+			udelay(1);
 	}
 
 	ICAP_ERR(icap, "writing %d dwords timeout", size);
@@ -1118,6 +1338,7 @@ static int bitstream_helper(struct icap *icap, const u32 *word_buffer,
 			err = -EIO;
 			break;
 		}
+		cond_resched();
 	}
 
 	return err;
@@ -1128,8 +1349,8 @@ static long icap_download(struct icap *icap, const char *buffer,
 {
 	long err = 0;
 	XHwIcap_Bit_Header bit_header = { 0 };
-	unsigned numCharsRead = DMA_HWICAP_BITFILE_BUFFER_SIZE;
-	unsigned byte_read;
+	ktime_t start;
+	s64 elapsed_us;
 
 	BUG_ON(!buffer);
 	BUG_ON(!length);
@@ -1147,20 +1368,25 @@ static long icap_download(struct icap *icap, const char *buffer,
 
 	buffer += bit_header.HeaderLength;
 
-	for (byte_read = 0; byte_read < bit_header.BitstreamLength;
-		byte_read += numCharsRead) {
-		numCharsRead = bit_header.BitstreamLength - byte_read;
-		if (numCharsRead > DMA_HWICAP_BITFILE_BUFFER_SIZE)
-			numCharsRead = DMA_HWICAP_BITFILE_BUFFER_SIZE;
-
-		err = bitstream_helper(icap, (u32 *)buffer,
-			numCharsRead / sizeof (u32));
-		if (err)
-			goto free_buffers;
-		buffer += numCharsRead;
-	}
+	/*
+	 * Hand the whole bitstream to bitstream_helper() so every burst is
+	 * sized by the current FIFO vacancy rather than capped at 1KB.
+	 */
+	start = ktime_get();
+	err = bitstream_helper(icap, (u32 *)buffer,
+		bit_header.BitstreamLength / sizeof (u32));
+	if (err)
+		goto free_buffers;
 
 	err = wait_for_done(icap);
+	if (err)
+		goto free_buffers;
+
+	elapsed_us = ktime_us_delta(ktime_get(), start);
+	ICAP_INFO(icap, "downloaded %u bytes in %lld us (%lld KB/s)",
+		bit_header.BitstreamLength, elapsed_us,
+		elapsed_us ? div64_s64((s64)bit_header.BitstreamLength * 1000,
+		elapsed_us) : 0);
 
 free_buffers:
 	kfree(bit_header.DesignName);
@@ -1170,47 +1396,77 @@ static long icap_download(struct icap *icap, const char *buffer,
 	return err;
 }
 
-static const struct axlf_section_header *get_axlf_section_hdr(
-	struct icap *icap, const struct axlf *top, enum axlf_section_kind kind)
+/*
+ * Validate the section table of an xclbin held in a buffer of len bytes and
+ * index it by kind. The first section of each kind wins, as it did with
+ * the old linear lookup.
+ */
+static int icap_index_axlf(struct icap *icap, const struct axlf *top,
+	uint64_t len, struct axlf_sect_index *idx)
 {
-	int i;
-	const struct axlf_section_header *hdr = NULL;
+	const struct axlf_section_header *hdr;
+	uint64_t xclbin_len;
+	uint32_t i;
+
+	memset(idx, 0, sizeof(*idx));
+
+	if (len < sizeof(struct axlf))
+		return -EINVAL;
 
-	ICAP_INFO(icap,
-		"trying to find section header for axlf section %d", kind);
+	xclbin_len = top->m_header.m_length;
+	if (xclbin_len > len || top->m_header.m_numSections == 0 ||
+		top->m_header.m_numSections > XOCL_AXLF_MAX_SECTIONS ||
+		offsetof(struct axlf, m_sections) +
+		top->m_header.m_numSections *
+		sizeof(struct axlf_section_header) > xclbin_len) {
+		ICAP_ERR(icap, "invalid axlf section table");
+		return -EINVAL;
+	}
 
 	for (i = 0; i < top->m_header.m_numSections; i++) {
-		ICAP_INFO(icap, "saw section header: %d",
-			top->m_sections[i].m_sectionKind);
-		if (top->m_sections[i].m_sectionKind == kind) {
-			hdr = &top->m_sections[i];
-			break;
+		hdr = &top->m_sections[i];
+		if (hdr->m_sectionOffset > xclbin_len ||
+			hdr->m_sectionSize > xclbin_len - hdr->m_sectionOffset) {
+			ICAP_ERR(icap, "section %d (kind %d) is out of bounds",
+				i, hdr->m_sectionKind);
+			return -EINVAL;
 		}
+		if (hdr->m_sectionKind < ICAP_AXLF_MAX_KIND &&
+			!idx->hdr[hdr->m_sectionKind])
+			idx->hdr[hdr->m_sectionKind] = hdr;
 	}
 
+	idx->top = top;
+	return 0;
+}
+
+static const struct axlf_section_header *get_axlf_section_hdr(
+	struct icap *icap, const struct axlf_sect_index *idx,
+	enum axlf_section_kind kind)
+{
+	const struct axlf_section_header *hdr = NULL;
+
+	if (kind < ICAP_AXLF_MAX_KIND)
+		hdr = idx->hdr[kind];
+
 	if (hdr) {
-		if ((hdr->m_sectionOffset + hdr->m_sectionSize) >
-			top->m_header.m_length) {
-			ICAP_INFO(icap, "found section is invalid");
-			hdr = NULL;
-		} else {
-			ICAP_INFO(icap, "header offset: %llu, size: %llu",
-				hdr->m_sectionOffset, hdr->m_sectionSize);
-		}
+		ICAP_DBG(icap, "section %d offset: %llu, size: %llu", kind,
+			hdr->m_sectionOffset, hdr->m_sectionSize);
 	} else {
-		ICAP_INFO(icap, "could not find section header %d", kind);
+		ICAP_DBG(icap, "could not find section header %d", kind);
 	}
 
 	return hdr;
 }
 
 static int alloc_and_get_axlf_section(struct icap *icap,
-	const struct axlf *top, enum axlf_section_kind kind,
+	const struct axlf_sect_index *idx, enum axlf_section_kind kind,
 	void **addr, uint64_t *size)
 {
 	void *section = NULL;
+	const struct axlf *top = idx->top;
 	const struct axlf_section_header *hdr =
-		get_axlf_section_hdr(icap, top, kind);
+		get_axlf_section_hdr(icap, idx, kind);
 
 	if (hdr == NULL)
 		return -EINVAL;
@@ -1251,6 +1507,7 @@ static int icap_download_boot_firmware(struct platform_device *pdev)
 	const struct axlf_section_header *primaryHeader = 0;
 	const struct axlf_section_header *secondaryHeader = 0;
 	const struct axlf_section_header *mbHeader = 0;
+	struct axlf_sect_index idx;
 	bool load_mbs = false;
 
 	/* Can only be done from mgmt pf. */
@@ -1308,10 +1565,20 @@ static int icap_download_boot_firmware(struct platform_device *pdev)
 	/* Grab lock and touch hardware. */
 	mutex_lock(&icap->icap_lock);
 
+	if (memcmp(fw->data, ICAP_XCLBIN_V2, sizeof (ICAP_XCLBIN_V2)) != 0) {
+		ICAP_ERR(icap, "invalid firmware %s", fw_name);
+		err = -EINVAL;
+		goto done;
+	}
+
+	bin_obj_axlf = (struct axlf *)fw->data;
+	err = icap_index_axlf(icap, bin_obj_axlf, fw->size, &idx);
+	if (err)
+		goto done;
+
 	if (xocl_mb_sched_on(xdev)) {
 		/* Try locating the microblaze binary. */
-		bin_obj_axlf = (struct axlf *)fw->data;
-		mbHeader = get_axlf_section_hdr(icap, bin_obj_axlf, SCHED_FIRMWARE);
+		mbHeader = get_axlf_section_hdr(icap, &idx, SCHED_FIRMWARE);
 		if (mbHeader) {
 			mbBinaryOffset = mbHeader->m_sectionOffset;
 			mbBinaryLength = mbHeader->m_sectionSize;
@@ -1325,8 +1592,7 @@ static int icap_download_boot_firmware(struct platform_device *pdev)
 
 	if (xocl_mb_mgmt_on(xdev)) {
 		/* Try locating the board mgmt binary. */
-		bin_obj_axlf = (struct axlf *)fw->data;
-		mbHeader = get_axlf_section_hdr(icap, bin_obj_axlf, FIRMWARE);
+		mbHeader = get_axlf_section_hdr(icap, &idx, FIRMWARE);
 		if (mbHeader) {
 			mbBinaryOffset = mbHeader->m_sectionOffset;
 			mbBinaryLength = mbHeader->m_sectionSize;
@@ -1341,15 +1607,7 @@ static int icap_download_boot_firmware(struct platform_device *pdev)
 	if (load_mbs)
 		xocl_mb_reset(xdev);
 
-
-	if (memcmp(fw->data, ICAP_XCLBIN_V2, sizeof (ICAP_XCLBIN_V2)) != 0) {
-		ICAP_ERR(icap, "invalid firmware %s", fw_name);
-		err = -EINVAL;
-		goto done;
-	}
-
 	ICAP_INFO(icap, "boot_firmware in axlf format");
-	bin_obj_axlf = (struct axlf *)fw->data;
 	length = bin_obj_axlf->m_header.m_length;
 	/* Match the xclbin with the hardware. */
 	if (!xocl_verify_timestamp(xdev,
@@ -1367,9 +1625,8 @@ static int icap_download_boot_firmware(struct platform_device *pdev)
 	}
 	ICAP_INFO(icap, "runtime version matched");
 
-	primaryHeader = get_axlf_section_hdr(icap, bin_obj_axlf, BITSTREAM);
-	secondaryHeader = get_axlf_section_hdr(icap, bin_obj_axlf,
-		CLEARING_BITSTREAM);
+	primaryHeader = get_axlf_section_hdr(icap, &idx, BITSTREAM);
+	secondaryHeader = get_axlf_section_hdr(icap, &idx, CLEARING_BITSTREAM);
 	if (primaryHeader) {
 		primaryFirmwareOffset = primaryHeader->m_sectionOffset;
 		primaryFirmwareLength = primaryHeader->m_sectionSize;
@@ -1477,10 +1734,11 @@ static long icap_download_clear_bitstream(struct icap *icap)
 }
 
 /*
- * This function should be called with icap_mutex lock held
+ * Validate the clock topology and work out the target frequencies from it,
+ * without touching hardware.
  */
-static long axlf_set_freqscaling(struct icap *icap, struct platform_device *pdev,
-	const char *clk_buf, unsigned long length)
+static long axlf_get_target_freqs(struct icap *icap, const char *clk_buf,
+	unsigned long length, unsigned short *target_freqs)
 {
 	struct clock_freq_topology *freqs = NULL;
 	int clock_type_count = 0;
@@ -1489,7 +1747,6 @@ static long axlf_set_freqscaling(struct icap *icap, struct platform_device *pdev
 	int data_clk_count = 0;
 	int kernel_clk_count = 0;
 	int system_clk_count = 0;
-	unsigned short target_freqs[4] = {0};
 
 	freqs = (struct clock_freq_topology *)clk_buf;
 	if (freqs->m_count > 4) {
@@ -1553,6 +1810,22 @@ static long axlf_set_freqscaling(struct icap *icap, struct platform_device *pdev
 	}
 
 
+	return 0;
+}
+
+/*
+ * This function should be called with icap_mutex lock held
+ */
+static long axlf_set_freqscaling(struct icap *icap, struct platform_device *pdev,
+	const char *clk_buf, unsigned long length)
+{
+	unsigned short target_freqs[4] = {0};
+	long err;
+
+	err = axlf_get_target_freqs(icap, clk_buf, length, target_freqs);
+	if (err)
+		return err;
+
 	ICAP_INFO(icap, "setting clock freq, "
 		"num: %lu, data_freq: %d , clk_freq: %d, "
 		"sys_freq[0]: %d, sys_freq[1]: %d",
@@ -1563,47 +1836,23 @@ static long axlf_set_freqscaling(struct icap *icap, struct platform_device *pdev
 
 
 static int icap_download_user(struct icap *icap, const char *bit_buf,
-	unsigned long length)
+	unsigned long length, struct icap_load_stat *stat)
 {
+	ktime_t frozen, t;
 	long err = 0;
-	XHwIcap_Bit_Header bit_header = { 0 };
-	unsigned numCharsRead = DMA_HWICAP_BITFILE_BUFFER_SIZE;
-	unsigned byte_read;
 
 	ICAP_INFO(icap, "downloading bitstream, length: %lu", length);
 
 	icap_freeze_axi_gate(icap);
+	frozen = ktime_get();
 
 	err = icap_download_clear_bitstream(icap);
 	if (err)
 		goto free_buffers;
 
-	if (bitstream_parse_header(icap, bit_buf,
-		DMA_HWICAP_BITFILE_BUFFER_SIZE, &bit_header)) {
-		err = -EINVAL;
-		goto free_buffers;
-	}
-	if ((bit_header.HeaderLength + bit_header.BitstreamLength) > length) {
-		err = -EINVAL;
-		goto free_buffers;
-	}
-
-	bit_buf += bit_header.HeaderLength;
-	for (byte_read = 0; byte_read < bit_header.BitstreamLength;
-		byte_read += numCharsRead) {
-		numCharsRead = bit_header.BitstreamLength - byte_read;
-		if (numCharsRead > DMA_HWICAP_BITFILE_BUFFER_SIZE)
-			numCharsRead = DMA_HWICAP_BITFILE_BUFFER_SIZE;
-
-		err = bitstream_helper(icap, (u32 *)bit_buf,
-			numCharsRead / sizeof (u32));
-		if (err)
-			goto free_buffers;
-
-		bit_buf += numCharsRead;
-	}
-
-	err = wait_for_done(icap);
+	t = ktime_get();
+	err = icap_download(icap, bit_buf, length);
+	stat->phase_us[ICAP_PHASE_PROGRAM] = ktime_us_delta(ktime_get(), t);
 	if (err)
 		goto free_buffers;
 
@@ -1614,18 +1863,22 @@ static int icap_download_user(struct icap *icap, const char *bit_buf,
 	 * configuration from before bitstream download as if nothing has
 	 * changed.
 	 */
-	if (!err)
-		err = icap_ocl_freqscaling(icap, true);
+	err = icap_ocl_freqscaling(icap, true);
 
 free_buffers:
 	icap_free_axi_gate(icap);
-	kfree(bit_header.DesignName);
-	kfree(bit_header.PartName);
-	kfree(bit_header.Date);
-	kfree(bit_header.Time);
+	stat->phase_us[ICAP_PHASE_FREEZE] = ktime_us_delta(ktime_get(), frozen);
 	return err;
 }
 
+/* Called with icap_lock held. */
+static void icap_record_load(struct icap *icap, struct icap_load_stat *stat)
+{
+	icap->icap_load_hist[icap->icap_load_count % ICAP_LOAD_HISTORY] =
+		*stat;
+	icap->icap_load_count++;
+}
+
 
 static int __icap_lock_peer(struct platform_device *pdev, const uuid_t *id)
 {
@@ -1704,8 +1957,60 @@ static int __icap_unlock_peer(struct platform_device *pdev, const uuid_t *id)
 }
 
 
-static int icap_download_bitstream_axlf(struct platform_device *pdev,
-	const void *u_xclbin)
+/*
+ * Ask the peer to load the xclbin from its own copy, identified by uuid,
+ * so that the bitstream does not have to cross the mailbox. Returns
+ * -ENOENT, so the caller sends the whole xclbin instead, if the request
+ * is lost or the peer does not support it or has no matching xclbin staged.
+ */
+static int icap_load_xclbin_by_uuid(struct platform_device *pdev,
+	const struct axlf *xclbin)
+{
+	struct icap *icap = platform_get_drvdata(pdev);
+	xdev_handle_t xdev = xocl_get_xdev(pdev);
+	struct mailbox_req *mb_req = NULL;
+	struct mailbox_bitstream_uuid *mb_uuid;
+	size_t data_len = sizeof(struct mailbox_req) +
+		sizeof(struct mailbox_bitstream_uuid);
+	int msg = -ETIMEDOUT;
+	size_t resplen = sizeof (msg);
+	int ver, err;
+
+	if (uuid_is_null(&xclbin->m_header.uuid))
+		return -ENOENT;
+
+	ver = xocl_mailbox_get_data(xdev, PEER_PROT_VER);
+	if (ver < MB_PROT_VER_XCLBIN_UUID)
+		return -ENOENT;
+
+	mb_req = vzalloc(data_len);
+	if (!mb_req)
+		return -ENOMEM;
+
+	mb_req->req = MAILBOX_REQ_LOAD_XCLBIN_UUID;
+	mb_req->data_total_len = data_len;
+	mb_uuid = (struct mailbox_bitstream_uuid *)mb_req->data;
+	uuid_copy(&mb_uuid->uuid, &xclbin->m_header.uuid);
+	mb_uuid->length = xclbin->m_header.m_length;
+
+	err = xocl_peer_request(xdev, mb_req, data_len, &msg, &resplen,
+		NULL, NULL);
+	vfree(mb_req);
+
+	if (err) {
+		ICAP_INFO(icap, "uuid load request failed: %d", err);
+		return -ENOENT;
+	}
+	if (msg == -ENOENT || msg == -EINVAL) {
+		ICAP_INFO(icap, "peer has no usable staged copy of xclbin %pUb",
+			&xclbin->m_header.uuid);
+		return -ENOENT;
+	}
+	return msg;
+}
+
+static int __icap_download_bitstream_axlf(struct platform_device *pdev,
+	const struct axlf_sect_index *idx, s64 copy_us)
 {
 	/*
 	 * decouple as 1. download xclbin, 2. parse xclbin 3. verify xclbin
@@ -1719,7 +2024,7 @@ static int icap_download_bitstream_axlf(struct platform_device *pdev,
 	const struct axlf_section_header *primaryHeader = NULL;
 	const struct axlf_section_header *clockHeader = NULL;
 	const struct axlf_section_header *secondaryHeader = NULL;
-	struct axlf *xclbin = (struct axlf *)u_xclbin;
+	struct axlf *xclbin = (struct axlf *)idx->top;
 	char *buffer;
 	xdev_handle_t xdev = xocl_get_xdev(pdev);
 	bool need_download;
@@ -1731,24 +2036,14 @@ static int icap_download_bitstream_axlf(struct platform_device *pdev,
 	struct mailbox_req *mb_req = NULL;
 	struct mailbox_bitstream_kaddr mb_addr = {0};
 	uuid_t peer_uuid;
+	struct icap_load_stat stat = { 0 };
+	ktime_t start = ktime_get(), t;
+	bool skipped = false;
 
-	if (memcmp(xclbin->m_magic, ICAP_XCLBIN_V2, sizeof(ICAP_XCLBIN_V2)))
-		return -EINVAL;
+	stat.phase_us[ICAP_PHASE_COPY] = copy_us;
+	uuid_copy(&stat.uuid, &xclbin->m_header.uuid);
 
 	if (ICAP_PRIVILEGED(icap)) {
-		if (xocl_xrt_version_check(xdev, xclbin, true)) {
-			ICAP_ERR(icap, "XRT version does not match");
-			return -EINVAL;
-		}
-
-		/* Match the xclbin with the hardware. */
-		if (!xocl_verify_timestamp(xdev,
-			xclbin->m_header.m_featureRomTimeStamp)) {
-			ICAP_ERR(icap, "timestamp of ROM not match Xclbin");
-			xocl_sysfs_error(xdev, "timestamp of ROM not match Xclbin");
-			return -EINVAL;
-		}
-
 		mutex_lock(&icap->icap_lock);
 
 		ICAP_INFO(icap,
@@ -1769,6 +2064,7 @@ static int icap_download_bitstream_axlf(struct platform_device *pdev,
 				msleep(50);
 			}
 			ICAP_INFO(icap, "bitstream already exists, skip downloading");
+			icap->icap_load_skipped++;
 		}
 
 		mutex_unlock(&icap->icap_lock);
@@ -1781,24 +2077,24 @@ static int icap_download_bitstream_axlf(struct platform_device *pdev,
 		 */
 		ICAP_INFO(icap, "finding CLOCK_FREQ_TOPOLOGY section");
 		/* Read the CLOCK section but defer changing clocks to later */
-		clockHeader = get_axlf_section_hdr(icap, xclbin,
+		clockHeader = get_axlf_section_hdr(icap, idx,
 			CLOCK_FREQ_TOPOLOGY);
 
 		ICAP_INFO(icap, "finding bitstream sections");
-		primaryHeader = get_axlf_section_hdr(icap, xclbin, BITSTREAM);
+		primaryHeader = get_axlf_section_hdr(icap, idx, BITSTREAM);
 		if (primaryHeader == NULL) {
 			err = -EINVAL;
-			goto done;
+			goto out;
 		}
 		primaryFirmwareOffset = primaryHeader->m_sectionOffset;
 		primaryFirmwareLength = primaryHeader->m_sectionSize;
 
-		secondaryHeader = get_axlf_section_hdr(icap, xclbin,
+		secondaryHeader = get_axlf_section_hdr(icap, idx,
 			CLEARING_BITSTREAM);
 		if (secondaryHeader) {
 			if (XOCL_PL_TO_PCI_DEV(pdev)->device == 0x7138) {
 				err = -EINVAL;
-				goto done;
+				goto out;
 			} else {
 				secondaryFirmwareOffset =
 					secondaryHeader->m_sectionOffset;
@@ -1822,7 +2118,10 @@ static int icap_download_bitstream_axlf(struct platform_device *pdev,
 			uint64_t clockFirmwareLength = clockHeader->m_sectionSize;
 			buffer = (char *)xclbin;
 			buffer += clockFirmwareOffset;
+			t = ktime_get();
 			err = axlf_set_freqscaling(icap, pdev, buffer, clockFirmwareLength);
+			stat.phase_us[ICAP_PHASE_CLOCK] =
+				ktime_us_delta(ktime_get(), t);
 			if (err)
 				goto done;
 			err = icap_setup_clock_freq_topology(icap, buffer, clockFirmwareLength);
@@ -1835,18 +2134,23 @@ static int icap_download_bitstream_axlf(struct platform_device *pdev,
 
 		buffer = (char *)xclbin;
 		buffer += primaryFirmwareOffset;
-		err = icap_download_user(icap, buffer, primaryFirmwareLength);
+		err = icap_download_user(icap, buffer, primaryFirmwareLength,
+			&stat);
 		if (err)
 			goto done;
 
-		buffer = (char *)u_xclbin;
+		buffer = (char *)xclbin;
 		buffer += secondaryFirmwareOffset;
 		err = icap_setup_clear_bitstream(icap, buffer, secondaryFirmwareLength);
 		if (err)
 			goto done;
 
-		if ((xocl_is_unified(xdev) || XOCL_DSA_XPR_ON(xdev)))
-			err = calibrate_mig(icap);
+		if ((xocl_is_unified(xdev) || XOCL_DSA_XPR_ON(xdev))) {
+			t = ktime_get();
+			err = calibrate_mig(icap, idx);
+			stat.phase_us[ICAP_PHASE_CALIB] =
+				ktime_us_delta(ktime_get(), t);
+		}
 		if (err)
 			goto done;
 
@@ -1870,6 +2174,13 @@ static int icap_download_bitstream_axlf(struct platform_device *pdev,
 			}
 		}
 
+		/*
+		 * Always ask the peer here, the host may have loaded another
+		 * xclbin behind our back. Whatever happens next, the clocks
+		 * may change, so drop the cached peer data.
+		 */
+		icap->icap_peer_cache_valid = 0;
+		uuid_copy(&peer_uuid, &uuid_null);
 		icap_read_from_peer(pdev, XCLBIN_UUID, &peer_uuid, sizeof(uuid_t));
 
 		if (!uuid_equal(&peer_uuid, &xclbin->m_header.uuid)) {
@@ -1891,6 +2202,7 @@ static int icap_download_bitstream_axlf(struct platform_device *pdev,
 				goto done;
 			}
 
+			t = ktime_get();
 			if ((peer_connected & 0xF) == MB_PEER_SAMEDOM_CONNECTED) {
 				data_len = sizeof(struct mailbox_req) + sizeof(struct mailbox_bitstream_kaddr);
 				mb_req = (struct mailbox_req *)vmalloc(data_len);
@@ -1904,6 +2216,10 @@ static int icap_download_bitstream_axlf(struct platform_device *pdev,
 				memcpy(mb_req->data, &mb_addr, sizeof(struct mailbox_bitstream_kaddr));
 
 			} else if ((peer_connected & 0xF) == MB_PEER_CONNECTED) {
+				msg = icap_load_xclbin_by_uuid(pdev, xclbin);
+				if (msg != -ENOENT)
+					goto peer_done;
+
 				data_len = sizeof(struct mailbox_req) +
 					xclbin->m_header.m_length;
 				mb_req = (struct mailbox_req *)vmalloc(data_len);
@@ -1912,7 +2228,7 @@ static int icap_download_bitstream_axlf(struct platform_device *pdev,
 					err = -ENOMEM;
 					goto done;
 				}
-				memcpy(mb_req->data, u_xclbin, xclbin->m_header.m_length);
+				memcpy(mb_req->data, xclbin, xclbin->m_header.m_length);
 				mb_req->req = MAILBOX_REQ_LOAD_XCLBIN;
 			}
 
@@ -1920,6 +2236,9 @@ static int icap_download_bitstream_axlf(struct platform_device *pdev,
 			(void) xocl_peer_request(xdev,
 				mb_req, data_len, &msg, &resplen, NULL, NULL);
 
+peer_done:
+			stat.phase_us[ICAP_PHASE_PEER] =
+				ktime_us_delta(ktime_get(), t);
 			if (msg != 0) {
 				ICAP_ERR(icap,
 					"%s peer failed to download xclbin",
@@ -1927,9 +2246,12 @@ static int icap_download_bitstream_axlf(struct platform_device *pdev,
 				err = -EFAULT;
 				goto done;
 			}
-		} else
+		} else {
 			ICAP_INFO(icap, "Already downloaded xclbin ID: %016llx",
 				xclbin->m_uniqueId);
+			icap->icap_load_skipped++;
+			skipped = true;
+		}
 
 		icap->icap_bitstream_id = xclbin->m_uniqueId;
 		if (!uuid_is_null(&xclbin->m_header.uuid)) {
@@ -1943,27 +2265,186 @@ static int icap_download_bitstream_axlf(struct platform_device *pdev,
 	}
 
 	if (ICAP_PRIVILEGED(icap)) {
-		icap_parse_bitstream_axlf_section(pdev, xclbin, MEM_TOPOLOGY);
-		icap_parse_bitstream_axlf_section(pdev, xclbin, IP_LAYOUT);
+		icap_parse_bitstream_axlf_section(pdev, idx, MEM_TOPOLOGY);
+		icap_parse_bitstream_axlf_section(pdev, idx, IP_LAYOUT);
 	} else {
-		icap_parse_bitstream_axlf_section(pdev, xclbin, IP_LAYOUT);
-		icap_parse_bitstream_axlf_section(pdev, xclbin, MEM_TOPOLOGY);
-		icap_parse_bitstream_axlf_section(pdev, xclbin, CONNECTIVITY);
-		icap_parse_bitstream_axlf_section(pdev, xclbin, DEBUG_IP_LAYOUT);
+		icap_parse_bitstream_axlf_section(pdev, idx, IP_LAYOUT);
+		icap_parse_bitstream_axlf_section(pdev, idx, MEM_TOPOLOGY);
+		icap_parse_bitstream_axlf_section(pdev, idx, CONNECTIVITY);
+		icap_parse_bitstream_axlf_section(pdev, idx, DEBUG_IP_LAYOUT);
 	}
 
 	if (ICAP_PRIVILEGED(icap))
-		err = icap_verify_bitstream_axlf(pdev, xclbin);
+		err = icap_verify_bitstream_axlf(pdev, idx);
 
 done:
+	if (!skipped) {
+		stat.err = err;
+		stat.phase_us[ICAP_PHASE_TOTAL] = ktime_us_delta(ktime_get(),
+			start);
+		icap_record_load(icap, &stat);
+	}
 	mutex_unlock(&icap->icap_lock);
+out:
+	/* Early exits, before icap_lock is taken, land here. */
 	vfree(mb_req);
 	ICAP_INFO(icap, "%s err: %ld", __FUNCTION__, err);
 	return err;
 }
 
+/*
+ * Check an xclbin against this device without touching hardware: section
+ * table, xrt version, ROM timestamp, bitstream header and clock topology.
+ * The section index is returned in idx for the download path to reuse.
+ */
+static int icap_check_axlf(struct icap *icap, const struct axlf *xclbin,
+	size_t len, struct axlf_sect_index *idx)
+{
+	xdev_handle_t xdev = xocl_get_xdev(icap->icap_pdev);
+	const struct axlf_section_header *hdr;
+	XHwIcap_Bit_Header bit_header = { 0 };
+	unsigned short target_freqs[4] = {0};
+	int err = 0;
+
+	if (memcmp(xclbin->m_magic, ICAP_XCLBIN_V2, sizeof(ICAP_XCLBIN_V2)))
+		return -EINVAL;
+
+	err = icap_index_axlf(icap, xclbin, len, idx);
+	if (err)
+		return err;
+
+	if (!ICAP_PRIVILEGED(icap))
+		return 0;
+
+	if (xocl_xrt_version_check(xdev, (struct axlf *)xclbin, true)) {
+		ICAP_ERR(icap, "XRT version does not match");
+		return -EINVAL;
+	}
+
+	/* Match the xclbin with the hardware. */
+	if (!xocl_verify_timestamp(xdev,
+		xclbin->m_header.m_featureRomTimeStamp)) {
+		ICAP_ERR(icap, "timestamp of ROM not match Xclbin");
+		xocl_sysfs_error(xdev, "timestamp of ROM not match Xclbin");
+		return -EINVAL;
+	}
+
+	hdr = get_axlf_section_hdr(icap, idx, BITSTREAM);
+	if (hdr && (bitstream_parse_header(icap,
+		(const unsigned char *)xclbin + hdr->m_sectionOffset,
+		min_t(uint64_t, hdr->m_sectionSize,
+		DMA_HWICAP_BITFILE_BUFFER_SIZE), &bit_header) ||
+		(bit_header.HeaderLength + bit_header.BitstreamLength) >
+		hdr->m_sectionSize))
+		err = -EINVAL;
+	kfree(bit_header.DesignName);
+	kfree(bit_header.PartName);
+	kfree(bit_header.Date);
+	kfree(bit_header.Time);
+	if (err) {
+		ICAP_ERR(icap, "invalid bitstream header");
+		return err;
+	}
+
+	if (get_axlf_section_hdr(icap, idx, CLEARING_BITSTREAM) &&
+		XOCL_PL_TO_PCI_DEV(icap->icap_pdev)->device == 0x7138)
+		return -EINVAL;
+
+	hdr = get_axlf_section_hdr(icap, idx, CLOCK_FREQ_TOPOLOGY);
+	if (hdr) {
+		err = axlf_get_target_freqs(icap,
+			(const char *)xclbin + hdr->m_sectionOffset,
+			hdr->m_sectionSize, target_freqs);
+	}
+
+	return err;
+}
+
+static int icap_download_bitstream_axlf(struct platform_device *pdev,
+	const void *u_xclbin, size_t len, s64 copy_us)
+{
+	struct icap *icap = platform_get_drvdata(pdev);
+	struct axlf_sect_index idx;
+	int err;
+
+	err = icap_check_axlf(icap, u_xclbin, len, &idx);
+	if (err)
+		return err;
+
+	return __icap_download_bitstream_axlf(pdev, &idx, copy_us);
+}
+
+/*
+ * Phase one of a two phase load: validate and keep a private copy of the
+ * xclbin while the current one keeps running. Only one xclbin is staged
+ * at a time, a new one replaces the previous.
+ */
+static int icap_stage_bitstream_axlf(struct platform_device *pdev,
+	const void *u_xclbin, size_t len)
+{
+	struct icap *icap = platform_get_drvdata(pdev);
+	const struct axlf *xclbin = u_xclbin;
+	struct axlf_sect_index idx;
+	struct axlf *staged;
+	int err;
+
+	if (!ICAP_PRIVILEGED(icap))
+		return -EPERM;
+
+	err = icap_check_axlf(icap, xclbin, len, &idx);
+	if (err)
+		return err;
+	if (!get_axlf_section_hdr(icap, &idx, BITSTREAM))
+		return -EINVAL;
+
+	staged = vmalloc(xclbin->m_header.m_length);
+	if (!staged)
+		return -ENOMEM;
+	memcpy(staged, xclbin, xclbin->m_header.m_length);
+
+	mutex_lock(&icap->icap_lock);
+	vfree(icap->icap_staged_xclbin);
+	icap->icap_staged_xclbin = staged;
+	icap->icap_staged_len = xclbin->m_header.m_length;
+	mutex_unlock(&icap->icap_lock);
+
+	ICAP_INFO(icap, "staged xclbin %pUb", &staged->m_header.uuid);
+	return 0;
+}
+
+/*
+ * Phase two: program the staged xclbin. All checks were done when it was
+ * staged, so this only covers the gate freeze, programming and the
+ * section bookkeeping that must follow it.
+ */
+static int icap_commit_bitstream_axlf(struct platform_device *pdev)
+{
+	struct icap *icap = platform_get_drvdata(pdev);
+	struct axlf_sect_index idx;
+	struct axlf *staged;
+	size_t len;
+	int err;
+
+	mutex_lock(&icap->icap_lock);
+	staged = icap->icap_staged_xclbin;
+	len = icap->icap_staged_len;
+	icap->icap_staged_xclbin = NULL;
+	icap->icap_staged_len = 0;
+	mutex_unlock(&icap->icap_lock);
+
+	if (!staged)
+		return -ENOENT;
+
+	/* Already validated when staged, this only rebuilds the index. */
+	err = icap_index_axlf(icap, staged, len, &idx);
+	if (!err)
+		err = __icap_download_bitstream_axlf(pdev, &idx, 0);
+	vfree(staged);
+	return err;
+}
+
 static int icap_verify_bitstream_axlf(struct platform_device *pdev,
-	struct axlf *xclbin)
+	const struct axlf_sect_index *idx)
 {
 	struct icap *icap = platform_get_drvdata(pdev);
 	int err = 0, i;
@@ -2064,7 +2545,7 @@ static int icap_verify_bitstream_axlf(struct platform_device *pdev,
 		if (is_axi) {
 			uint32_t *cert = NULL;
 
-			if (alloc_and_get_axlf_section(icap, xclbin,
+			if (alloc_and_get_axlf_section(icap, idx,
 				DNA_CERTIFICATE,
 				(void **)&cert, &section_size) != 0) {
 
@@ -2252,16 +2733,13 @@ static int icap_unlock_bitstream(struct platform_device *pdev, const uuid_t *id,
 }
 
 static int icap_parse_bitstream_axlf_section(struct platform_device *pdev,
-	const struct axlf *xclbin, enum axlf_section_kind kind)
+	const struct axlf_sect_index *idx, enum axlf_section_kind kind)
 {
 	struct icap *icap = platform_get_drvdata(pdev);
 	long err = 0;
 	uint64_t section_size = 0, sect_sz = 0;
 	void **target = NULL;
 
-	if (memcmp(xclbin->m_magic, ICAP_XCLBIN_V2, sizeof(ICAP_XCLBIN_V2)))
-		return -EINVAL;
-
 	switch (kind) {
 	case IP_LAYOUT:
 		target = (void **)&icap->ip_layout;
@@ -2282,7 +2760,7 @@ static int icap_parse_bitstream_axlf_section(struct platform_device *pdev,
 		vfree(*target);
 		*target = NULL;
 	}
-	err = alloc_and_get_axlf_section(icap, xclbin, kind,
+	err = alloc_and_get_axlf_section(icap, idx, kind,
 		target, &section_size);
 	if (err != 0)
 		goto done;
@@ -2327,6 +2805,21 @@ static uint64_t icap_get_data(struct platform_device *pdev,
 	case XCLBIN_UUID:
 		target = (uint64_t)&icap->icap_bitstream_uuid;
 		break;
+	case CLOCK_FREQ_0:
+	case CLOCK_FREQ_1:
+		target = icap_get_ocl_frequency(icap, kind - CLOCK_FREQ_0);
+		break;
+	case FREQ_COUNTER_0:
+	case FREQ_COUNTER_1:
+		target = icap_get_clock_frequency_counter_khz(icap,
+			kind - FREQ_COUNTER_0);
+		break;
+	case DATA_CLK_MAX:
+		if (icap->icap_clock_freq_topology)
+			target = ((struct clock_freq_topology *)
+				icap->icap_clock_freq_topology)->
+				m_clock_freq[0].m_freq_Mhz;
+		break;
 	default:
 		break;
 	}
@@ -2334,18 +2827,32 @@ static uint64_t icap_get_data(struct platform_device *pdev,
 	return target;
 }
 
+static void icap_load_skipped(struct platform_device *pdev)
+{
+	struct icap *icap = platform_get_drvdata(pdev);
+
+	mutex_lock(&icap->icap_lock);
+	icap->icap_load_skipped++;
+	mutex_unlock(&icap->icap_lock);
+}
+
 /* Kernel APIs exported from this sub-device driver. */
 static struct xocl_icap_funcs icap_ops = {
 	.reset_axi_gate = platform_reset_axi_gate,
 	.reset_bitstream = icap_reset_bitstream,
 	.download_boot_firmware = icap_download_boot_firmware,
 	.download_bitstream_axlf = icap_download_bitstream_axlf,
+	.stage_bitstream_axlf = icap_stage_bitstream_axlf,
+	.commit_bitstream_axlf = icap_commit_bitstream_axlf,
 	.ocl_set_freq = icap_ocl_set_freqscaling,
 	.ocl_get_freq = icap_ocl_get_freqscaling,
 	.ocl_update_clock_freq_topology = icap_ocl_update_clock_freq_topology,
+	.ocl_update_clock_freq_idle = icap_ocl_update_clock_freq_idle,
 	.ocl_lock_bitstream = icap_lock_bitstream,
 	.ocl_unlock_bitstream = icap_unlock_bitstream,
 	.get_data = icap_get_data,
+	.peer_cache_invalidate = icap_peer_cache_invalidate,
+	.load_skipped = icap_load_skipped,
 };
 
 static ssize_t clock_freq_topology_show(struct device *dev,
@@ -2480,7 +2987,8 @@ static ssize_t idcode_show(struct device *dev,
 	if (ICAP_PRIVILEGED(icap)) {
 		cnt = sprintf(buf, "0x%x\n", icap->idcode);
 	} else {
-		icap_read_from_peer(to_platform_device(dev), IDCODE, &val, sizeof(unsigned int));
+		val = 0;
+		icap_read_from_peer_cached(icap, IDCODE, &val, sizeof(u32));
 		cnt = sprintf(buf, "0x%x\n", val);
 	}
 	mutex_unlock(&icap->icap_lock);
@@ -2490,10 +2998,45 @@ static ssize_t idcode_show(struct device *dev,
 
 static DEVICE_ATTR_RO(idcode);
 
+/* Per-phase time in us of the last loads, most recent first. */
+static ssize_t load_timing_show(struct device *dev,
+	struct device_attribute *attr, char *buf)
+{
+	struct icap *icap = platform_get_drvdata(to_platform_device(dev));
+	const struct icap_load_stat *stat;
+	ssize_t cnt = 0;
+	u32 i, n;
+	int p;
+
+	mutex_lock(&icap->icap_lock);
+	cnt += sprintf(buf + cnt, "loads %u skipped %u\n",
+		icap->icap_load_count, icap->icap_load_skipped);
+	cnt += sprintf(buf + cnt, "uuid err");
+	for (p = 0; p < ICAP_PHASE_NUM; p++)
+		cnt += sprintf(buf + cnt, " %s", icap_phase_names[p]);
+	cnt += sprintf(buf + cnt, "\n");
+
+	n = min_t(u32, icap->icap_load_count, ICAP_LOAD_HISTORY);
+	for (i = 1; i <= n; i++) {
+		stat = &icap->icap_load_hist[(icap->icap_load_count - i) %
+			ICAP_LOAD_HISTORY];
+		cnt += sprintf(buf + cnt, "%pUb %d", &stat->uuid, stat->err);
+		for (p = 0; p < ICAP_PHASE_NUM; p++)
+			cnt += sprintf(buf + cnt, " %lld", stat->phase_us[p]);
+		cnt += sprintf(buf + cnt, "\n");
+	}
+	mutex_unlock(&icap->icap_lock);
+
+	return cnt;
+}
+
+static DEVICE_ATTR_RO(load_timing);
+
 static struct attribute *icap_attrs[] = {
 	&dev_attr_clock_freq_topology.attr,
 	&dev_attr_clock_freqs.attr,
 	&dev_attr_idcode.attr,
+	&dev_attr_load_timing.attr,
 	NULL,
 };
 
@@ -2689,6 +3232,7 @@ static int icap_remove(struct platform_device *pdev)
 
 	if (icap->bit_buffer)
 		vfree(icap->bit_buffer);
+	vfree(icap->icap_staged_xclbin);
 
 	iounmap(icap->icap_regs);
 	iounmap(icap->icap_state);
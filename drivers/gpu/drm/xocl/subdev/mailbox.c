@@ -33,12 +33,18 @@
  * The driver implemented two transport layers - packet and message layer (see
  * below). A packet is a fixed size chunk of data that can be send through TX
  * channel or retrieved from RX channel. The TX and RX interrupt happens at
- * packet boundary, instead of DWORD boundary. The driver will not attempt to
- * send next packet until the previous one is read by peer. Similarly, the
- * driver will not attempt to read the data from HW until a full packet has been
- * written to HW by peer. No polling is implemented. Data transfer is entirely
- * interrupt driven. So, the interrupt functionality needs to work and enabled
- * on both mgmt and user pf for mailbox driver to function properly.
+ * packet boundary, instead of DWORD boundary. When the peer speaks protocol
+ * version MB_PROT_VER_TX_WINDOW or later, the driver pushes packets of the
+ * active message until the FIFO is full, then waits for the peer to drain it.
+ * Otherwise, it will not send the next packet until the previous one is read
+ * by peer. On the RX side, the driver reads every full packet available each
+ * time it is woken up, and will not read the data from HW until a full packet
+ * has been written to HW by peer. Data transfer is normally interrupt driven. When the
+ * interrupt is not available (mailbox_no_intr, or while the device is being
+ * reset), both channels are polled by a high resolution timer instead. The
+ * poll interval starts at MAILBOX_POLL_MIN_US whenever a packet moves and
+ * doubles on every idle poll, up to MAILBOX_POLL_BUSY_US while a message is
+ * in flight and up to MAILBOX_POLL_IDLE_US otherwise.
  *
  * A TX packet is considered as time'd out after sitting in the TX channel of
  * mailbox HW for two packet ticks (1 packet tick = 1 second, for now) without
@@ -61,18 +67,29 @@
  * message. However, for the sake of simplicity, at message layer, the driver
  * will not attempt to send the next message until the sending of current one
  * is finished. I.E., we implement a FIFO for message TX channel. All messages
- * are sent by driver in the order of received from upper layer. We can
- * implement messages of different priority later, if needed. There is no
+ * are sent by driver in the order of received from upper layer, except that
+ * short messages (up to MAILBOX_URGENT_LEN bytes) are urgent and go before
+ * longer ones. If the peer speaks MB_PROT_VER_PREEMPT or later, an urgent
+ * message may also preempt a long one being sent: the long one is parked
+ * at a packet boundary, the urgent one is sent with PKT_TYPE_PREEMPT in its
+ * start packet, then the long one resumes. The receiving side parks its
+ * partial message the same way. Only one message can be parked. There is no
  * certain order for receiving messages. It's up to the peer side to decide
  * which message gets enqueued into its own TX queue first, which will be
  * received first on the other side.
  *
  * A message is considered as time'd out when it's transmit (send or receive)
- * is not finished within 10 packet ticks. This applies to all messages queued
- * up on both RX and TX channels. Again, no retry for a time'd out message is
- * implemented. The error will be simply passed to upper layer. Also, a TX
- * message may time out earlier if it's being transmitted and one of it's
- * packets time'd out. During normal operation, timeout should never happen.
+ * is not finished within its timeout, counted from the moment it becomes
+ * active (a response from the moment its request is sent out). The timeout
+ * defaults to 10 seconds or 2 seconds per MB, whichever is longer, and
+ * mailbox_request() can shorten or lengthen it per call, with per request
+ * type defaults when the caller does not care. Expiry is driven by a per
+ * channel hrtimer armed for the earliest deadline, not by the packet tick.
+ * This applies to all messages queued up on both RX and TX channels. Again,
+ * no retry for a time'd out message is implemented. The error will be simply
+ * passed to upper layer. Also, a TX message may time out earlier if it's
+ * being transmitted and one of it's packets time'd out. During normal
+ * operation, timeout should never happen.
  *
  * The upper layer can choose to queue a message for TX or RX asynchronously
  * when it provides a callback or wait synchronously when no callback is
@@ -117,6 +134,17 @@
  * | RX/TX Channel    | <<======>> | RX/TX Channel    |
  * +------------------+            +------------------+
  *   mgmt pf                         user pf
+ *
+ *
+ * Loopback transport
+ *
+ * When the module is loaded with mailbox_loopback=1, two extra mailbox
+ * instances are created without any hardware behind them. Their register
+ * reads and writes are served by two cross-connected in-memory FIFOs (see
+ * mailbox_sw_reg_rd() / mailbox_sw_reg_wr()), so the msg and packet layers
+ * run exactly as they do against the real IP, in polling mode. Each end
+ * echoes back any request not handled by the mailbox itself, and the
+ * mailbox_bench sysfs node measures request / response round trips.
  */
 
 #include <linux/mutex.h>
@@ -125,6 +153,11 @@
 #include <linux/device.h>
 #include <linux/crc32c.h>
 #include <linux/random.h>
+#include <linux/hrtimer.h>
+#include <linux/mm.h>
+#include <linux/spinlock.h>
+#include <linux/ktime.h>
+#include <linux/workqueue.h>
 #include "../xocl_drv.h"
 
 int mailbox_no_intr;
@@ -132,6 +165,16 @@ module_param(mailbox_no_intr, int, (S_IRUGO|S_IWUSR));
 MODULE_PARM_DESC(mailbox_no_intr,
 	"Disable mailbox interrupt and do timer-driven msg passing");
 
+unsigned int mailbox_req_queue_len;
+module_param(mailbox_req_queue_len, uint, (S_IRUGO|S_IWUSR));
+MODULE_PARM_DESC(mailbox_req_queue_len,
+	"Max outstanding peer requests per device (0 = size by system memory)");
+
+int mailbox_loopback;
+module_param(mailbox_loopback, int, S_IRUGO);
+MODULE_PARM_DESC(mailbox_loopback,
+	"Create a pair of in-memory loopback mailboxes for benchmarking");
+
 #define	PACKET_SIZE	16 /* Number of DWORD. */
 
 #define	FLAG_STI	(1 << 0)
@@ -150,15 +193,41 @@ MODULE_PARM_DESC(mailbox_no_intr,
 	xocl_dbg(&mbx->mbx_pdev->dev, fmt "\n", ##arg)
 
 #define	MAILBOX_TIMER	HZ	/* in jiffies */
-#define	MSG_TTL		10	/* in MAILBOX_TIMER */
+#define	MAILBOX_POLL_MIN_US	10
+#define	MAILBOX_POLL_BUSY_US	1000
+#define	MAILBOX_POLL_IDLE_US	USEC_PER_SEC
+#define	MAILBOX_RX_BUDGET	256	/* pkts per RX worker pass */
+#define	MAILBOX_TX_WINDOW	64	/* pkts per TX worker pass */
+#define	MAILBOX_URGENT_LEN	1024	/* longest msg that may preempt */
+#define	MAILBOX_LB_NAME	"mailbox_lb" SUBDEV_SUFFIX
+#define	MAILBOX_SW_FIFO_DEPTH	(PACKET_SIZE * 32)	/* in DWORD */
+#define	MAILBOX_BENCH_MAX_LEN	(1024 * 1024)
+#define	MAILBOX_LAT_BUCKETS	24	/* log2(usec), last one is >= 4s */
+#define	MAILBOX_CONN_RETRY_MIN_MS	2	/* first SYN timeout */
+#define	MAILBOX_CONN_RETRY_MAX_MS	256	/* cap of the backoff */
+#define	MAILBOX_CONN_RETRIES		16	/* then wait for peer's SYN */
+#define	MSG_TTL_MS		10000	/* default msg timeout */
+#define	MSG_TTL_MS_PER_MB	2000	/* timeout per MB for long msgs */
+/* Per request type defaults, see mailbox_req_timeout(). */
+#define	MAILBOX_REQ_TIMEOUT_SHORT_MS	2000
+#define	MAILBOX_REQ_TIMEOUT_LONG_MS	60000
 #define	TEST_MSG_LEN	128
 
 #define	INVALID_MSG_ID	((u64)-1)
 #define	MSG_FLAG_RESPONSE	(1 << 0)
 #define	MSG_FLAG_REQUEST (1 << 1)
 
+/*
+ * Bounds for the incoming request queue. The actual limits are picked per
+ * device at probe time from the amount of system memory, see
+ * mailbox_req_queue_init(), and can be changed later through sysfs. The
+ * byte cap never defaults below MAX_MSG_QUEUE_SZ, which has to fit an
+ * xclbin sent over the mailbox.
+ */
+#define MIN_MSG_QUEUE_SZ  (PAGE_SIZE << 4)
 #define MAX_MSG_QUEUE_SZ  (PAGE_SIZE << 16)
-#define MAX_MSG_QUEUE_LEN 5
+#define MIN_MSG_QUEUE_LEN 5
+#define MAX_MSG_QUEUE_LEN 4096
 
 #define MB_CONN_INIT	(0x1<<0)
 #define MB_CONN_SYN 	(0x1<<1)
@@ -197,8 +266,14 @@ struct mailbox_msg {
 	mailbox_msg_cb_t	mbm_cb;
 	void			*mbm_cb_arg;
 	u32			mbm_flags;
-	int			mbm_ttl;
+	u32			mbm_timeout_ms;
+	ktime_t			mbm_deadline;
 	bool			mbm_timer_on;
+	bool			mbm_urgent;
+	/* Statistics, see mailbox_stat_done(). */
+	int			mbm_stat_type;
+	bool			mbm_stat_final;
+	ktime_t			mbm_enqueue_ts;
 };
 
 /*
@@ -224,6 +299,7 @@ enum conn_state {
 /* Lower 8 bits for type, the rest for flags. */
 #define	PKT_TYPE_MASK		0xff
 #define	PKT_TYPE_MSG_END	(1 << 31)
+#define	PKT_TYPE_PREEMPT	(1 << 30)
 struct mailbox_pkt {
 	struct {
 		u32		type;
@@ -251,6 +327,7 @@ struct mailbox_pkt {
 #define MBXCS_BIT_TICK		2
 #define MBXCS_BIT_CHK_STALL	3
 #define MBXCS_BIT_POLL_MODE	4
+#define MBXCS_BIT_EXPIRE	5
 
 struct mailbox_channel;
 typedef	void (*chan_func_t)(struct mailbox_channel *ch);
@@ -271,8 +348,53 @@ struct mailbox_channel {
 	int			mbc_bytes_done;
 	struct mailbox_pkt	mbc_packet;
 
+	/* Long msg set aside while an urgent one preempts it. */
+	struct mailbox_msg	*mbc_parked_msg;
+	int			mbc_parked_bytes;
+
 	struct timer_list	mbc_timer;
 	bool			mbc_timer_on;
+
+	/* Fires at the earliest deadline of the msgs on this channel. */
+	struct hrtimer		mbc_expire_timer;
+	spinlock_t		mbc_expire_lock;
+
+	/* Adaptive polling when interrupt is not in use. */
+	struct hrtimer		mbc_poll_timer;
+	u32			mbc_poll_us;
+	u64			mbc_pkts;
+};
+
+/* Bytes and latency histograms (log2 usec) of one request type. */
+struct mailbox_req_stat {
+	u64			mrs_count;
+	u64			mrs_bytes;
+	u64			mrs_timeouts;
+	u64			mrs_errors;
+	u64			mrs_sent_hist[MAILBOX_LAT_BUCKETS];
+	u64			mrs_resp_hist[MAILBOX_LAT_BUCKETS];
+};
+
+/*
+ * Software replacement of the mailbox IP for the loopback transport.
+ * fifo[i] carries DWORDs written by end i and read by the other end.
+ */
+struct mailbox_sw_fifo {
+	u32			msf_data[MAILBOX_SW_FIFO_DEPTH];
+	u32			msf_head;
+	u32			msf_cnt;
+};
+
+struct mailbox_sw_wire {
+	spinlock_t		msw_lock;
+	struct mailbox_sw_fifo	msw_fifo[2];
+	struct mailbox		*msw_end[2];
+	struct platform_device	*msw_pdev[2];
+};
+
+struct mailbox_lb_pdata {
+	struct mailbox_sw_wire	*wire;
+	int			end;
 };
 
 /*
@@ -306,16 +428,37 @@ struct mailbox {
 	struct completion mbx_comp;
 	struct mutex mbx_lock;
 	struct list_head mbx_req_list;
-	uint8_t mbx_req_cnt;
+	uint32_t mbx_req_cnt;
 	size_t mbx_req_sz;
+	uint32_t mbx_req_max_cnt;
+	size_t mbx_req_max_sz;
+	uint64_t mbx_req_rejected;
+
+	/* Per request type statistics of locally originated requests. */
+	spinlock_t mbx_stat_lock;
+	struct mailbox_req_stat mbx_stats[MAILBOX_REQ_MAX];
 
 	struct mutex mbx_conn_lock;
 	uint64_t mbx_conn_id;
 	enum conn_state mbx_state;
 	bool mbx_established;
 	uint32_t mbx_prot_ver;
+	uint32_t mbx_peer_prot_ver;
+	struct delayed_work mbx_conn_retry;
+	uint32_t mbx_conn_retries;
+	ktime_t mbx_conn_start;
+	s64 mbx_conn_us;
 
 	void *mbx_kaddr;
+
+	/* Loopback transport only. */
+	struct mailbox_sw_wire *mbx_sw;
+	int mbx_sw_end;
+	u32 mbx_sw_err;
+	u32 mbx_bench_msgs;
+	size_t mbx_bench_len;
+	s64 mbx_bench_us;
+	int mbx_bench_err;
 };
 
 static inline const char *reg2name(struct mailbox *mbx, u32 *reg)
@@ -349,7 +492,7 @@ struct mailbox_conn{
 };
 
 int mailbox_request(struct platform_device *, void *, size_t,
-	void *, size_t *, mailbox_msg_cb_t, void *);
+	void *, size_t *, mailbox_msg_cb_t, void *, u32);
 int mailbox_post(struct platform_device *, u64, void *, size_t);
 static int mailbox_connect_status(struct platform_device *pdev);
 static void connect_state_handler(struct mailbox *mbx, struct mailbox_conn *conn);
@@ -364,9 +507,12 @@ static void connect_state_touch(struct mailbox *mbx, uint64_t flag)
 }
 
 
+static u32 mailbox_sw_reg_rd(struct mailbox *mbx, u32 *reg);
+static void mailbox_sw_reg_wr(struct mailbox *mbx, u32 *reg, u32 val);
+
 static inline u32 mailbox_reg_rd(struct mailbox *mbx, u32 *reg)
 {
-	u32 val = ioread32(reg);
+	u32 val = mbx->mbx_sw ? mailbox_sw_reg_rd(mbx, reg) : ioread32(reg);
 
 #ifdef	MAILBOX_REG_DEBUG
 	MBX_DBG(mbx, "REG_RD(%s)=0x%x", reg2name(mbx, reg), val);
@@ -379,7 +525,10 @@ static inline void mailbox_reg_wr(struct mailbox *mbx, u32 *reg, u32 val)
 #ifdef	MAILBOX_REG_DEBUG
 	MBX_DBG(mbx, "REG_WR(%s, 0x%x)", reg2name(mbx, reg), val);
 #endif
-	iowrite32(val, reg);
+	if (mbx->mbx_sw)
+		mailbox_sw_reg_wr(mbx, reg, val);
+	else
+		iowrite32(val, reg);
 }
 
 static inline void reset_pkt(struct mailbox_pkt *pkt)
@@ -473,11 +622,120 @@ static void chan_config_timer(struct mailbox_channel *ch)
 	mutex_unlock(&ch->mbc_mutex);
 }
 
+static enum hrtimer_restart chan_poll_timer(struct hrtimer *t)
+{
+	struct mailbox_channel *ch =
+		container_of(t, struct mailbox_channel, mbc_poll_timer);
+
+	complete(&ch->mbc_worker);
+	return HRTIMER_NORESTART;
+}
+
+static inline bool chan_polling(struct mailbox_channel *ch)
+{
+	return ch->mbc_parent->mbx_irq == (u32)-1;
+}
+
+static bool chan_inflight(struct mailbox_channel *ch)
+{
+	bool busy;
+
+	mutex_lock(&ch->mbc_mutex);
+	busy = ch->mbc_cur_msg || !list_empty(&ch->mbc_msgs);
+	mutex_unlock(&ch->mbc_mutex);
+
+	return busy;
+}
+
+/*
+ * Re-arm the poll timer after a pass of the channel worker. Poll fast right
+ * after a packet has moved, and back off exponentially while nothing happens.
+ */
+static void chan_poll_rearm(struct mailbox_channel *ch, bool progress)
+{
+	u32 cap;
+
+	if (!chan_polling(ch))
+		return;
+
+	cap = chan_inflight(ch) ? MAILBOX_POLL_BUSY_US : MAILBOX_POLL_IDLE_US;
+	if (progress)
+		ch->mbc_poll_us = MAILBOX_POLL_MIN_US;
+	else
+		ch->mbc_poll_us = min(ch->mbc_poll_us * 2, cap);
+
+	hrtimer_start(&ch->mbc_poll_timer, ns_to_ktime((u64)ch->mbc_poll_us *
+		NSEC_PER_USEC), HRTIMER_MODE_REL);
+}
+
+/* New work queued, restart polling from the shortest interval. */
+static void chan_poll_kick(struct mailbox_channel *ch)
+{
+	if (!ch->mbc_parent || !chan_polling(ch))
+		return;
+
+	ch->mbc_poll_us = MAILBOX_POLL_MIN_US;
+	hrtimer_start(&ch->mbc_poll_timer, ns_to_ktime((u64)ch->mbc_poll_us *
+		NSEC_PER_USEC), HRTIMER_MODE_REL);
+}
+
 static void free_msg(struct mailbox_msg *msg)
 {
 	vfree(msg);
 }
 
+static void mailbox_stat_submit(struct mailbox *mbx, struct mailbox_msg *msg,
+	bool final)
+{
+	u32 type = ((struct mailbox_req *)msg->mbm_data)->req;
+
+	if (msg->mbm_len < sizeof(struct mailbox_req) || type >= MAILBOX_REQ_MAX)
+		return;
+
+	msg->mbm_stat_type = type;
+	msg->mbm_stat_final = final;
+	spin_lock(&mbx->mbx_stat_lock);
+	mbx->mbx_stats[type].mrs_count++;
+	mbx->mbx_stats[type].mrs_bytes += msg->mbm_len;
+	spin_unlock(&mbx->mbx_stat_lock);
+}
+
+/*
+ * A request is sent as a TX msg and, unless it is posted, completed by a RX
+ * msg carrying the response. The TX msg records how long the request waited
+ * to go out on the wire; the RX msg records the whole round trip. Errors are
+ * only counted against the msg that ends the transaction.
+ */
+static void mailbox_stat_done(struct mailbox *mbx, struct mailbox_msg *msg,
+	int err)
+{
+	struct mailbox_req_stat *st;
+	s64 us;
+	int b;
+
+	if (msg->mbm_stat_type < 0)
+		return;
+
+	us = ktime_us_delta(ktime_get(), msg->mbm_enqueue_ts);
+	b = us <= 0 ? 0 : min_t(int, fls64(us), MAILBOX_LAT_BUCKETS - 1);
+
+	spin_lock(&mbx->mbx_stat_lock);
+	st = &mbx->mbx_stats[msg->mbm_stat_type];
+	if (err == 0 && msg->mbm_ch == &mbx->mbx_tx) {
+		st->mrs_sent_hist[b]++;
+	} else if (err == 0) {
+		/* Channel still holds the bytes received for this msg. */
+		st->mrs_resp_hist[b]++;
+		st->mrs_bytes += msg->mbm_ch->mbc_bytes_done;
+	} else if (msg->mbm_stat_final) {
+		if (err == -ETIME)
+			st->mrs_timeouts++;
+		else
+			st->mrs_errors++;
+	}
+	spin_unlock(&mbx->mbx_stat_lock);
+}
+
 static void msg_done(struct mailbox_msg *msg, int err)
 {
 	struct mailbox_channel *ch = msg->mbm_ch;
@@ -486,6 +744,8 @@ static void msg_done(struct mailbox_msg *msg, int err)
 	MBX_DBG(ch->mbc_parent, "%s finishing msg id=0x%llx err=%d",
 		ch->mbc_name, msg->mbm_req_id, err);
 
+	mailbox_stat_done(mbx, msg, err);
+
 	msg->mbm_error = err;
 	if (msg->mbm_cb) {
 		msg->mbm_cb(msg->mbm_cb_arg, msg->mbm_data, msg->mbm_len,
@@ -493,11 +753,16 @@ static void msg_done(struct mailbox_msg *msg, int err)
 		free_msg(msg);
 	} else {
 		if (msg->mbm_flags & MSG_FLAG_REQUEST) {
-			if ((mbx->mbx_req_sz+msg->mbm_len) >= MAX_MSG_QUEUE_SZ ||
-				  mbx->mbx_req_cnt >= MAX_MSG_QUEUE_LEN) {
+			mutex_lock(&ch->mbc_parent->mbx_lock);
+			if ((mbx->mbx_req_sz+msg->mbm_len) >= mbx->mbx_req_max_sz ||
+				  mbx->mbx_req_cnt >= mbx->mbx_req_max_cnt) {
+				mbx->mbx_req_rejected++;
+				mutex_unlock(&ch->mbc_parent->mbx_lock);
+				MBX_DBG(mbx, "request queue full, dropping msg id=0x%llx",
+					msg->mbm_req_id);
+				free_msg(msg);
 				goto done;
 			}
-			mutex_lock(&ch->mbc_parent->mbx_lock);
 			list_add_tail(&msg->mbm_list, &ch->mbc_parent->mbx_req_list);
 			mbx->mbx_req_cnt++;
 			mbx->mbx_req_sz += msg->mbm_len;
@@ -520,6 +785,62 @@ static void chan_msg_done(struct mailbox_channel *ch, int err)
 	msg_done(ch->mbc_cur_msg, err);
 	ch->mbc_cur_msg = NULL;
 	ch->mbc_bytes_done = 0;
+
+	/* The preempting msg is over, resume the parked one. */
+	if (ch->mbc_parked_msg) {
+		ch->mbc_cur_msg = ch->mbc_parked_msg;
+		ch->mbc_bytes_done = ch->mbc_parked_bytes;
+		ch->mbc_parked_msg = NULL;
+		ch->mbc_parked_bytes = 0;
+	}
+}
+
+/* Fail the active msg and the one it preempted, if any. */
+static void chan_msg_done_all(struct mailbox_channel *ch, int err)
+{
+	while (ch->mbc_cur_msg)
+		chan_msg_done(ch, err);
+}
+
+static void chan_msg_park(struct mailbox_channel *ch)
+{
+	BUG_ON(ch->mbc_parked_msg);
+
+	ch->mbc_parked_msg = ch->mbc_cur_msg;
+	ch->mbc_parked_bytes = ch->mbc_bytes_done;
+	ch->mbc_cur_msg = NULL;
+	ch->mbc_bytes_done = 0;
+}
+
+static enum hrtimer_restart chan_expire_timer(struct hrtimer *timer)
+{
+	struct mailbox_channel *ch =
+		container_of(timer, struct mailbox_channel, mbc_expire_timer);
+
+	set_bit(MBXCS_BIT_EXPIRE, &ch->mbc_state);
+	complete(&ch->mbc_worker);
+	return HRTIMER_NORESTART;
+}
+
+/* Make sure the expiry timer fires no later than deadline. */
+static void chan_expire_arm(struct mailbox_channel *ch, ktime_t deadline)
+{
+	struct hrtimer *t = &ch->mbc_expire_timer;
+	unsigned long flags;
+
+	spin_lock_irqsave(&ch->mbc_expire_lock, flags);
+	if (!hrtimer_active(t) ||
+		ktime_before(deadline, hrtimer_get_expires(t)))
+		hrtimer_start(t, deadline, HRTIMER_MODE_ABS);
+	spin_unlock_irqrestore(&ch->mbc_expire_lock, flags);
+}
+
+/* Start counting down the msg's timeout. */
+static void msg_timer_on(struct mailbox_channel *ch, struct mailbox_msg *msg)
+{
+	msg->mbm_deadline = ktime_add_ms(ktime_get(), msg->mbm_timeout_ms);
+	msg->mbm_timer_on = true;
+	chan_expire_arm(ch, msg->mbm_deadline);
 }
 
 void timeout_msg(struct mailbox_channel *ch)
@@ -528,23 +849,20 @@ void timeout_msg(struct mailbox_channel *ch)
 	struct mailbox_msg *msg = NULL;
 	struct list_head *pos, *n;
 	struct list_head l = LIST_HEAD_INIT(l);
-	bool reschedule = false;
+	ktime_t now = ktime_get();
+	ktime_t next = KTIME_MAX;
 
 	/* Check active msg first. */
 	msg = ch->mbc_cur_msg;
-	if (msg) {
-
-		if (msg->mbm_ttl == 0) {
-			MBX_ERR(mbx, "found active msg time'd out");
-			chan_msg_done(ch, -ETIME);
-		} else {
-			if (msg->mbm_timer_on) {
-				msg->mbm_ttl--;
-				/* Need to come back again for this one. */
-				reschedule = true;
-			}
-		}
+	if (msg && msg->mbm_timer_on &&
+		!ktime_before(now, msg->mbm_deadline)) {
+		MBX_ERR(mbx, "found active msg time'd out");
+		chan_msg_done(ch, -ETIME);
 	}
+	/* Possibly a parked msg resumed by chan_msg_done(). */
+	msg = ch->mbc_cur_msg;
+	if (msg && msg->mbm_timer_on)
+		next = msg->mbm_deadline;
 
 	mutex_lock(&ch->mbc_mutex);
 
@@ -554,18 +872,20 @@ void timeout_msg(struct mailbox_channel *ch)
 			continue;
 		if (msg->mbm_req_id == 0)
 		       continue;
-		if (msg->mbm_ttl == 0) {
+		if (!ktime_before(now, msg->mbm_deadline)) {
 			list_del(&msg->mbm_list);
 			list_add_tail(&msg->mbm_list, &l);
-		} else {
-			msg->mbm_ttl--;
+		} else if (ktime_before(msg->mbm_deadline, next)) {
 			/* Need to come back again for this one. */
-			reschedule = true;
+			next = msg->mbm_deadline;
 		}
 	}
 
 	mutex_unlock(&ch->mbc_mutex);
 
+	if (next != KTIME_MAX)
+		chan_expire_arm(ch, next);
+
 	if (!list_empty(&l))
 		MBX_ERR(mbx, "found waiting msg time'd out");
 
@@ -581,10 +901,13 @@ static void chann_worker(struct work_struct *work)
 	struct mailbox_channel *ch =
 		container_of(work, struct mailbox_channel, mbc_work);
 	struct mailbox *mbx = ch->mbc_parent;
+	u64 pkts;
 
 	while (!test_bit(MBXCS_BIT_STOP, &ch->mbc_state)) {
 		MBX_DBG(mbx, "%s worker start", ch->mbc_name);
+		pkts = ch->mbc_pkts;
 		ch->mbc_tran(ch);
+		chan_poll_rearm(ch, ch->mbc_pkts != pkts);
 		wait_for_completion_interruptible(&ch->mbc_worker);
 	}
 }
@@ -618,12 +941,14 @@ static int chan_msg_enqueue(struct mailbox_channel *ch, struct mailbox_msg *msg)
 	} else {
 		list_add_tail(&msg->mbm_list, &ch->mbc_msgs);
 		msg->mbm_ch = ch;
-//		msg->mbm_ttl = MSG_TTL;
+		msg->mbm_enqueue_ts = ktime_get();
 	}
 	mutex_unlock(&ch->mbc_mutex);
 
 	chan_config_timer(ch);
 
+	chan_poll_kick(ch);
+
 	return rv;
 }
 
@@ -635,10 +960,18 @@ static struct mailbox_msg *chan_msg_dequeue(struct mailbox_channel *ch,
 
 	mutex_lock(&ch->mbc_mutex);
 
-	/* Take the first msg. */
+	/* Take the first urgent msg, or the first msg. */
 	if (req_id == INVALID_MSG_ID) {
 		msg = list_first_entry_or_null(&ch->mbc_msgs,
 			struct mailbox_msg, mbm_list);
+		list_for_each(pos, &ch->mbc_msgs) {
+			if (list_entry(pos, struct mailbox_msg,
+				mbm_list)->mbm_urgent) {
+				msg = list_entry(pos, struct mailbox_msg,
+					mbm_list);
+				break;
+			}
+		}
 	/* Take the msg w/ specified ID. */
 	} else {
 		list_for_each(pos, &ch->mbc_msgs) {
@@ -659,12 +992,33 @@ static struct mailbox_msg *chan_msg_dequeue(struct mailbox_channel *ch,
 	return msg;
 }
 
+static struct mailbox_msg *chan_msg_dequeue_urgent(struct mailbox_channel *ch)
+{
+	struct mailbox_msg *msg = NULL, *tmp;
+
+	mutex_lock(&ch->mbc_mutex);
+	list_for_each_entry(tmp, &ch->mbc_msgs, mbm_list) {
+		if (tmp->mbm_urgent) {
+			msg = tmp;
+			list_del(&msg->mbm_list);
+			break;
+		}
+	}
+	mutex_unlock(&ch->mbc_mutex);
+
+	return msg;
+}
+
+/* Time a msg of len bytes may take on the wire. */
+static inline u32 msg_len_timeout(size_t len)
+{
+	return (len >> 20) * MSG_TTL_MS_PER_MB;
+}
+
 static struct mailbox_msg *alloc_msg(void *buf, size_t len)
 {
 	char *newbuf = NULL;
 	struct mailbox_msg *msg = NULL;
-	/* Give MB*2 secs as time to live */
-	int calculated_ttl = (len >> 19) < MSG_TTL ? MSG_TTL : (len >> 19);
 
 	if (!buf) {
 		msg = vzalloc(sizeof(struct mailbox_msg) + len);
@@ -681,8 +1035,10 @@ static struct mailbox_msg *alloc_msg(void *buf, size_t len)
 	INIT_LIST_HEAD(&msg->mbm_list);
 	msg->mbm_data = newbuf;
 	msg->mbm_len = len;
-	msg->mbm_ttl = calculated_ttl;
+	msg->mbm_timeout_ms = max_t(u32, MSG_TTL_MS, msg_len_timeout(len));
 	msg->mbm_timer_on = false;
+	msg->mbm_urgent = (len <= MAILBOX_URGENT_LEN);
+	msg->mbm_stat_type = -1;
 	init_completion(&msg->mbm_complete);
 
 	return msg;
@@ -721,6 +1077,12 @@ static int chan_init(struct mailbox *mbx, char *nm,
 #else
 	timer_setup(&ch->mbc_timer, chan_timer, 0);
 #endif
+	hrtimer_init(&ch->mbc_expire_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	ch->mbc_expire_timer.function = chan_expire_timer;
+	spin_lock_init(&ch->mbc_expire_lock);
+	hrtimer_init(&ch->mbc_poll_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	ch->mbc_poll_timer.function = chan_poll_timer;
+	ch->mbc_poll_us = MAILBOX_POLL_MIN_US;
 
 	return 0;
 }
@@ -743,10 +1105,10 @@ static void chan_fini(struct mailbox_channel *ch)
 	complete(&ch->mbc_worker);
 	cancel_work_sync(&ch->mbc_work);
 	destroy_workqueue(ch->mbc_wq);
+	hrtimer_cancel(&ch->mbc_poll_timer);
+	hrtimer_cancel(&ch->mbc_expire_timer);
 
-	msg = ch->mbc_cur_msg;
-	if (msg)
-		chan_msg_done(ch, -ESHUTDOWN);
+	chan_msg_done_all(ch, -ESHUTDOWN);
 
 	while ((msg = chan_msg_dequeue(ch, INVALID_MSG_ID)) != NULL)
 		msg_done(msg, -ESHUTDOWN);
@@ -789,6 +1151,7 @@ static void chan_recv_pkt(struct mailbox_channel *ch)
 		reset_pkt(pkt);
 	else
 		MBX_DBG(mbx, "received pkt: type=0x%x", pkt->hdr.type);
+	ch->mbc_pkts++;
 }
 
 static void chan_send_pkt(struct mailbox_channel *ch)
@@ -810,6 +1173,7 @@ static void chan_send_pkt(struct mailbox_channel *ch)
 	reset_pkt(pkt);
 	if (ch->mbc_cur_msg)
 		ch->mbc_bytes_done += ch->mbc_packet.hdr.payload_size;
+	ch->mbc_pkts++;
 
 	BUG_ON((mailbox_chk_err(mbx) & STATUS_FULL) != 0);
 }
@@ -847,89 +1211,112 @@ static int chan_pkt2msg(struct mailbox_channel *ch)
 	return 0;
 }
 
+/* Check if a packet is ready for reading. */
+static bool chan_rx_ready(struct mailbox_channel *ch)
+{
+	struct mailbox *mbx = ch->mbc_parent;
+	u32 st = mailbox_reg_rd(mbx, &mbx->mbx_regs->mbr_status);
+
+	/* Device is still being reset. */
+	if (st == 0xffffffff)
+		return false;
+	if (test_bit(MBXCS_BIT_POLL_MODE, &ch->mbc_state))
+		return (st & STATUS_EMPTY) == 0;
+	return (st & STATUS_RTA) != 0;
+}
+
 /*
- * Worker for RX channel.
+ * Read one packet from HW and fold it into the active msg.
  */
-static void chan_do_rx(struct mailbox_channel *ch)
+static void chan_rx_pkt(struct mailbox_channel *ch)
 {
 	struct mailbox *mbx = ch->mbc_parent;
 	struct mailbox_pkt *pkt = &ch->mbc_packet;
 	struct mailbox_msg *msg = NULL;
-	bool needs_read = false;
 	u64 id = 0;
 	bool eom;
 	int err;
 	u32 type;
-	u32 st = mailbox_reg_rd(mbx, &mbx->mbx_regs->mbr_status);
 
-	/* Check if a packet is ready for reading. */
-	if (st == 0xffffffff) {
-		/* Device is still being reset. */
-		needs_read = false;
-	} else if (test_bit(MBXCS_BIT_POLL_MODE, &ch->mbc_state)) {
-		needs_read = ((st & STATUS_EMPTY) == 0);
-	} else {
-		needs_read = ((st & STATUS_RTA) != 0);
-	}
+	chan_recv_pkt(ch);
+	type = pkt->hdr.type & PKT_TYPE_MASK;
+	eom = ((pkt->hdr.type & PKT_TYPE_MSG_END) != 0);
 
-	if (needs_read) {
-		chan_recv_pkt(ch);
-		type = pkt->hdr.type & PKT_TYPE_MASK;
-		eom = ((pkt->hdr.type & PKT_TYPE_MSG_END) != 0);
+	switch (type) {
+	case PKT_TEST:
+		(void) memcpy(&mbx->mbx_tst_pkt, &ch->mbc_packet,
+			sizeof(struct mailbox_pkt));
+		reset_pkt(pkt);
+		return;
+	case PKT_MSG_START:
+		if (ch->mbc_cur_msg && (pkt->hdr.type & PKT_TYPE_PREEMPT) &&
+			!ch->mbc_parked_msg) {
+			chan_msg_park(ch);
+		} else if (ch->mbc_cur_msg) {
+			MBX_ERR(mbx, "received partial msg\n");
+			chan_msg_done_all(ch, -EBADMSG);
+		}
 
-		switch (type) {
-		case PKT_TEST:
-			(void) memcpy(&mbx->mbx_tst_pkt, &ch->mbc_packet,
-				sizeof(struct mailbox_pkt));
-			reset_pkt(pkt);
-			return;
-		case PKT_MSG_START:
-			if (ch->mbc_cur_msg) {
-				MBX_ERR(mbx, "received partial msg\n");
-				chan_msg_done(ch, -EBADMSG);
-			}
+		/* Get a new active msg. */
+		id = 0;
+		if (pkt->body.msg_start.msg_flags & MSG_FLAG_RESPONSE)
+			id = pkt->body.msg_start.msg_req_id;
+		ch->mbc_cur_msg = chan_msg_dequeue(ch, id);
 
-			/* Get a new active msg. */
-			id = 0;
-			if (pkt->body.msg_start.msg_flags & MSG_FLAG_RESPONSE)
-				id = pkt->body.msg_start.msg_req_id;
-			ch->mbc_cur_msg = chan_msg_dequeue(ch, id);
-
-			if (!ch->mbc_cur_msg) {
-				//no msg, alloc dynamically
-				msg = alloc_msg(NULL, pkt->body.msg_start.msg_size);
-
-				msg->mbm_ch = ch;
-				msg->mbm_flags |= MSG_FLAG_REQUEST;
-				ch->mbc_cur_msg = msg;
-
-			}	else if (pkt->body.msg_start.msg_size >
-				ch->mbc_cur_msg->mbm_len) {
-				chan_msg_done(ch, -EMSGSIZE);
-				MBX_ERR(mbx, "received msg is too big");
-				reset_pkt(pkt);
-			}
-			break;
-		case PKT_MSG_BODY:
-			if (!ch->mbc_cur_msg) {
-				MBX_ERR(mbx, "got unexpected msg body pkt\n");
-				reset_pkt(pkt);
-			}
-			break;
-		default:
-			MBX_ERR(mbx, "invalid mailbox pkt type\n");
+		if (!ch->mbc_cur_msg) {
+			//no msg, alloc dynamically
+			msg = alloc_msg(NULL, pkt->body.msg_start.msg_size);
+
+			msg->mbm_ch = ch;
+			msg->mbm_flags |= MSG_FLAG_REQUEST;
+			ch->mbc_cur_msg = msg;
+
+		}	else if (pkt->body.msg_start.msg_size >
+			ch->mbc_cur_msg->mbm_len) {
+			chan_msg_done(ch, -EMSGSIZE);
+			MBX_ERR(mbx, "received msg is too big");
 			reset_pkt(pkt);
-			return;
 		}
+		break;
+	case PKT_MSG_BODY:
+		if (!ch->mbc_cur_msg) {
+			MBX_ERR(mbx, "got unexpected msg body pkt\n");
+			reset_pkt(pkt);
+		}
+		break;
+	default:
+		MBX_ERR(mbx, "invalid mailbox pkt type\n");
+		reset_pkt(pkt);
+		return;
+	}
+
+	if (valid_pkt(pkt)) {
+		err = chan_pkt2msg(ch);
+		if (err || eom)
+			chan_msg_done(ch, err);
+	}
+}
+
+/*
+ * Worker for RX channel. Drain every packet the peer has pushed so far, a
+ * windowed sender may have queued several behind one interrupt.
+ */
+static void chan_do_rx(struct mailbox_channel *ch)
+{
+	int budget = MAILBOX_RX_BUDGET;
 
-		if (valid_pkt(pkt)) {
-			err = chan_pkt2msg(ch);
-			if (err || eom)
-				chan_msg_done(ch, err);
+	while (chan_rx_ready(ch)) {
+		chan_rx_pkt(ch);
+		if (--budget == 0) {
+			/* Let the timer work in, then come back for the rest. */
+			complete(&ch->mbc_worker);
+			break;
 		}
 	}
 
 	/* Handle timer event. */
+	if (test_and_clear_bit(MBXCS_BIT_EXPIRE, &ch->mbc_state))
+		timeout_msg(ch);
 	if (test_bit(MBXCS_BIT_TICK, &ch->mbc_state)) {
 		timeout_msg(ch);
 		clear_bit(MBXCS_BIT_TICK, &ch->mbc_state);
@@ -961,6 +1348,8 @@ static void chan_msg2pkt(struct mailbox_channel *ch)
 
 	pkt->hdr.type = is_start ? PKT_MSG_START : PKT_MSG_BODY;
 	pkt->hdr.type |= is_eom ? PKT_TYPE_MSG_END : 0;
+	if (is_start && ch->mbc_parked_msg)
+		pkt->hdr.type |= PKT_TYPE_PREEMPT;
 	pkt->hdr.payload_size = cnt;
 
 	if (is_start) {
@@ -994,7 +1383,7 @@ static void check_tx_stall(struct mailbox_channel *ch)
 	if (test_bit(MBXCS_BIT_CHK_STALL, &ch->mbc_state)) {
 		MBX_ERR(mbx, "TX channel stall detected, reset...\n");
 		mailbox_reg_wr(mbx, &mbx->mbx_regs->mbr_ctrl, 0x1);
-		chan_msg_done(ch, -ETIME);
+		chan_msg_done_all(ch, -ETIME);
 		connect_state_touch(mbx, MB_CONN_FIN);
 	/* Mark it for next check. */
 	} else {
@@ -1016,7 +1405,7 @@ static void rx_enqueued_msg_timer_on(struct mailbox *mbx, uint64_t req_id)
 	list_for_each_safe(pos, n, &ch->mbc_msgs) {
 		msg = list_entry(pos, struct mailbox_msg, mbm_list);
 		if (msg->mbm_req_id == req_id) {
-			msg->mbm_timer_on = true;
+			msg_timer_on(ch, msg);
 			MBX_DBG(mbx, "set ch rx, req_id %llu\n", req_id);
 			break;
 		}
@@ -1026,6 +1415,18 @@ static void rx_enqueued_msg_timer_on(struct mailbox *mbx, uint64_t req_id)
 
 }
 
+/*
+ * Number of packets that may be pushed before waiting for the peer to drain
+ * the FIFO. Older peers pick up one packet per RX interrupt, so only send
+ * them one at a time.
+ */
+static int chan_tx_window(struct mailbox *mbx)
+{
+	if (mbx->mbx_peer_prot_ver < MB_PROT_VER_TX_WINDOW)
+		return 1;
+	return MAILBOX_TX_WINDOW;
+}
+
 /*
  * Worker for TX channel.
  */
@@ -1033,6 +1434,7 @@ static void chan_do_tx(struct mailbox_channel *ch)
 {
 	struct mailbox *mbx = ch->mbc_parent;
 	u32 st = mailbox_reg_rd(mbx, &mbx->mbx_regs->mbr_status);
+	int i, window;
 
 	/* Check if a packet has been read by peer. */
 	if ((st != 0xffffffff) && ((st & STATUS_STA) != 0)) {
@@ -1048,12 +1450,23 @@ static void chan_do_tx(struct mailbox_channel *ch)
 			(ch->mbc_cur_msg->mbm_len == ch->mbc_bytes_done)) {
 			rx_enqueued_msg_timer_on(mbx, ch->mbc_cur_msg->mbm_req_id);
 			chan_msg_done(ch, 0);
+		} else if (ch->mbc_cur_msg && ch->mbc_bytes_done &&
+			!ch->mbc_cur_msg->mbm_urgent && !ch->mbc_parked_msg &&
+			mbx->mbx_peer_prot_ver >= MB_PROT_VER_PREEMPT) {
+			/* Let an urgent msg cut in on a long one. */
+			struct mailbox_msg *urgent = chan_msg_dequeue_urgent(ch);
+
+			if (urgent) {
+				chan_msg_park(ch);
+				ch->mbc_cur_msg = urgent;
+				msg_timer_on(ch, urgent);
+			}
 		}
 
 		if (!ch->mbc_cur_msg) {
 			ch->mbc_cur_msg = chan_msg_dequeue(ch, INVALID_MSG_ID);
 			if (ch->mbc_cur_msg)
-				ch->mbc_cur_msg->mbm_timer_on = true;
+				msg_timer_on(ch, ch->mbc_cur_msg);
 		}
 
 		if (ch->mbc_cur_msg) {
@@ -1067,9 +1480,27 @@ static void chan_do_tx(struct mailbox_channel *ch)
 		}
 
 		chan_send_pkt(ch);
+
+		/*
+		 * Keep filling the FIFO with the rest of the active msg. The
+		 * FIFO depth is a power of 2 no smaller than a packet, so it
+		 * can only turn full on a packet boundary. A msg is still only
+		 * done once the peer has drained its last packet.
+		 */
+		window = chan_tx_window(mbx);
+		for (i = 1; i < window && ch->mbc_cur_msg &&
+			ch->mbc_bytes_done < ch->mbc_cur_msg->mbm_len; i++) {
+			st = mailbox_reg_rd(mbx, &mbx->mbx_regs->mbr_status);
+			if (st == 0xffffffff || (st & STATUS_FULL))
+				break;
+			chan_msg2pkt(ch);
+			chan_send_pkt(ch);
+		}
 	}
 
 	/* Handle timer event. */
+	if (test_and_clear_bit(MBXCS_BIT_EXPIRE, &ch->mbc_state))
+		timeout_msg(ch);
 	if (test_bit(MBXCS_BIT_TICK, &ch->mbc_state)) {
 		timeout_msg(ch);
 		check_tx_stall(ch);
@@ -1087,6 +1518,17 @@ static int mailbox_connect_status(struct platform_device *pdev)
 	return ret;
 }
 
+static int mailbox_peer_prot_ver(struct platform_device *pdev)
+{
+	struct mailbox *mbx = platform_get_drvdata(pdev);
+	int ret = 0;
+	mutex_lock(&mbx->mbx_lock);
+	if (mbx->mbx_paired & MB_PEER_CONNECTED)
+		ret = mbx->mbx_peer_prot_ver;
+	mutex_unlock(&mbx->mbx_lock);
+	return ret;
+}
+
 static ssize_t mailbox_ctl_show(struct device *dev,
 	struct device_attribute *attr, char *buf)
 {
@@ -1189,7 +1631,7 @@ static ssize_t mailbox_show(struct device *dev,
 
 	req.req = MAILBOX_REQ_TEST_READ;
 	ret = mailbox_request(to_platform_device(dev), &req, sizeof (req),
-		mbx->mbx_tst_rx_msg, &respsz, NULL, NULL);
+		mbx->mbx_tst_rx_msg, &respsz, NULL, NULL, 0);
 	if (ret) {
 		MBX_ERR(mbx, "failed to read test msg from peer: %d", ret);
 	} else if (respsz > 0) {
@@ -1234,12 +1676,154 @@ static ssize_t connection_show(struct device *dev,
 }
 static DEVICE_ATTR_RO(connection);
 
+static ssize_t connection_time_us_show(struct device *dev,
+	struct device_attribute *attr, char *buf)
+{
+	struct platform_device *pdev = to_platform_device(dev);
+	struct mailbox *mbx = platform_get_drvdata(pdev);
+	ssize_t n;
+
+	mutex_lock(&mbx->mbx_lock);
+	n = sprintf(buf, "%lld %u\n", mbx->mbx_conn_us,
+		mbx->mbx_conn_retries);
+	mutex_unlock(&mbx->mbx_lock);
+	return n;
+}
+/* Time taken by the last handshake: <usecs, -1 if never> <SYN resends>. */
+static DEVICE_ATTR_RO(connection_time_us);
+
+static ssize_t req_queue_max_show(struct device *dev,
+	struct device_attribute *attr, char *buf)
+{
+	struct platform_device *pdev = to_platform_device(dev);
+	struct mailbox *mbx = platform_get_drvdata(pdev);
+	ssize_t n;
+
+	mutex_lock(&mbx->mbx_lock);
+	n = sprintf(buf, "%u %zu\n", mbx->mbx_req_max_cnt,
+		mbx->mbx_req_max_sz);
+	mutex_unlock(&mbx->mbx_lock);
+	return n;
+}
+
+static ssize_t req_queue_max_store(struct device *dev,
+	struct device_attribute *da, const char *buf, size_t count)
+{
+	struct platform_device *pdev = to_platform_device(dev);
+	struct mailbox *mbx = platform_get_drvdata(pdev);
+	u32 val;
+	u64 sz = 0;
+	int n;
+
+	n = sscanf(buf, "%u %llu", &val, &sz);
+	if (n < 1 || val == 0 || val > MAX_MSG_QUEUE_LEN ||
+		(n == 2 && sz < MIN_MSG_QUEUE_SZ)) {
+		MBX_ERR(mbx, "input should be <count> [<bytes>], count within "
+			"[1, %d], bytes at least %lu", MAX_MSG_QUEUE_LEN,
+			MIN_MSG_QUEUE_SZ);
+		return -EINVAL;
+	}
+
+	mutex_lock(&mbx->mbx_lock);
+	mbx->mbx_req_max_cnt = val;
+	if (n == 2)
+		mbx->mbx_req_max_sz = sz;
+	mutex_unlock(&mbx->mbx_lock);
+	return count;
+}
+/*
+ * Outstanding peer request limit: <max count> <max bytes>. Writing only a
+ * count leaves the byte limit alone.
+ */
+static DEVICE_ATTR_RW(req_queue_max);
+
+static ssize_t req_queue_rejected_show(struct device *dev,
+	struct device_attribute *attr, char *buf)
+{
+	struct platform_device *pdev = to_platform_device(dev);
+	struct mailbox *mbx = platform_get_drvdata(pdev);
+	ssize_t n;
+
+	mutex_lock(&mbx->mbx_lock);
+	n = sprintf(buf, "%llu\n", mbx->mbx_req_rejected);
+	mutex_unlock(&mbx->mbx_lock);
+	return n;
+}
+static DEVICE_ATTR_RO(req_queue_rejected);
+
+static ssize_t mailbox_stat_hist(char *buf, ssize_t n, const char *name,
+	u64 *hist)
+{
+	int b;
+
+	n += scnprintf(buf + n, PAGE_SIZE - n, "  %s_us:", name);
+	for (b = 0; b < MAILBOX_LAT_BUCKETS; b++) {
+		if (!hist[b])
+			continue;
+		n += scnprintf(buf + n, PAGE_SIZE - n, " %s%llu:%llu",
+			b == MAILBOX_LAT_BUCKETS - 1 ? ">=" : "<",
+			b == MAILBOX_LAT_BUCKETS - 1 ? 1ULL << (b - 1) :
+			1ULL << b, hist[b]);
+	}
+	n += scnprintf(buf + n, PAGE_SIZE - n, "\n");
+	return n;
+}
+
+static ssize_t mailbox_stats_show(struct device *dev,
+	struct device_attribute *attr, char *buf)
+{
+	struct platform_device *pdev = to_platform_device(dev);
+	struct mailbox *mbx = platform_get_drvdata(pdev);
+	struct mailbox_req_stat *st;
+	ssize_t n = 0;
+	int i;
+
+	st = vmalloc(sizeof(mbx->mbx_stats));
+	if (!st)
+		return -ENOMEM;
+	spin_lock(&mbx->mbx_stat_lock);
+	memcpy(st, mbx->mbx_stats, sizeof(mbx->mbx_stats));
+	spin_unlock(&mbx->mbx_stat_lock);
+
+	for (i = 0; i < MAILBOX_REQ_MAX; i++) {
+		if (!st[i].mrs_count)
+			continue;
+		n += scnprintf(buf + n, PAGE_SIZE - n,
+			"req %d: count %llu bytes %llu timeouts %llu errors %llu\n",
+			i, st[i].mrs_count, st[i].mrs_bytes,
+			st[i].mrs_timeouts, st[i].mrs_errors);
+		n = mailbox_stat_hist(buf, n, "sent", st[i].mrs_sent_hist);
+		n = mailbox_stat_hist(buf, n, "resp", st[i].mrs_resp_hist);
+	}
+
+	vfree(st);
+	return n;
+}
+
+static ssize_t mailbox_stats_store(struct device *dev,
+	struct device_attribute *da, const char *buf, size_t count)
+{
+	struct platform_device *pdev = to_platform_device(dev);
+	struct mailbox *mbx = platform_get_drvdata(pdev);
+
+	spin_lock(&mbx->mbx_stat_lock);
+	memset(mbx->mbx_stats, 0, sizeof(mbx->mbx_stats));
+	spin_unlock(&mbx->mbx_stat_lock);
+	return count;
+}
+/* Per request type statistics, any write clears them. */
+static DEVICE_ATTR_RW(mailbox_stats);
+
 
 static struct attribute *mailbox_attrs[] = {
 	&dev_attr_mailbox.attr,
 	&dev_attr_mailbox_ctl.attr,
 	&dev_attr_mailbox_pkt.attr,
 	&dev_attr_connection.attr,
+	&dev_attr_connection_time_us.attr,
+	&dev_attr_req_queue_max.attr,
+	&dev_attr_req_queue_rejected.attr,
+	&dev_attr_mailbox_stats.attr,
 	NULL,
 };
 
@@ -1274,17 +1858,41 @@ static void dft_post_msg_cb(void *arg, void *buf, size_t len, u64 id, int err)
 	}
 }
 
+/*
+ * Quick queries should fail fast when peer is gone, while an xclbin
+ * download may legitimately keep peer busy for a long time.
+ */
+static u32 mailbox_req_timeout(enum mailbox_request req)
+{
+	switch (req) {
+	case MAILBOX_REQ_TEST_READ:
+	case MAILBOX_REQ_PEER_DATA:
+		return MAILBOX_REQ_TIMEOUT_SHORT_MS;
+	case MAILBOX_REQ_LOAD_XCLBIN_KADDR:
+	case MAILBOX_REQ_LOAD_XCLBIN:
+	case MAILBOX_REQ_LOAD_XCLBIN_UUID:
+		return MAILBOX_REQ_TIMEOUT_LONG_MS;
+	default:
+		return MSG_TTL_MS;
+	}
+}
+
 /*
  * Msg will be sent to peer and reply will be received.
+ *
+ * Send a request and, unless cb is given, wait for its response. The
+ * response must arrive within timeout_ms after the request is sent out,
+ * 0 picks the default for the request type.
  */
 int mailbox_request(struct platform_device *pdev, void *req, size_t reqlen,
-	void *resp, size_t *resplen, mailbox_msg_cb_t cb, void *cbarg)
+	void *resp, size_t *resplen, mailbox_msg_cb_t cb, void *cbarg,
+	u32 timeout_ms)
 {
 	int rv = -ENOMEM;
 	struct mailbox *mbx = platform_get_drvdata(pdev);
 	struct mailbox_msg *reqmsg = NULL, *respmsg = NULL;
 
-	MBX_INFO(mbx, "sending request: %d", ((struct mailbox_req *)req)->req);
+	MBX_DBG(mbx, "sending request: %d", ((struct mailbox_req *)req)->req);
 
 	if (cb) {
 		reqmsg = alloc_msg(NULL, reqlen);
@@ -1307,6 +1915,16 @@ int mailbox_request(struct platform_device *pdev, void *req, size_t reqlen,
 	/* Only interested in response w/ same ID. */
 	respmsg->mbm_req_id = reqmsg->mbm_req_id;
 
+	if (!timeout_ms)
+		timeout_ms = mailbox_req_timeout(((struct mailbox_req *)req)->req);
+	reqmsg->mbm_timeout_ms = max_t(u32, timeout_ms, msg_len_timeout(reqlen));
+	respmsg->mbm_timeout_ms = max_t(u32, timeout_ms,
+		msg_len_timeout(*resplen));
+
+	mailbox_stat_submit(mbx, reqmsg, false);
+	respmsg->mbm_stat_type = reqmsg->mbm_stat_type;
+	respmsg->mbm_stat_final = true;
+
 	/* Always enqueue RX msg before TX one to avoid race. */
 	rv = chan_msg_enqueue(&mbx->mbx_rx, respmsg);
 	if (rv)
@@ -1342,7 +1960,8 @@ int mailbox_request(struct platform_device *pdev, void *req, size_t reqlen,
 /*
  * Msg will be posted, no wait for reply.
  */
-int mailbox_post(struct platform_device *pdev, u64 reqid, void *buf, size_t len)
+static int __mailbox_post(struct platform_device *pdev, u64 reqid, void *buf,
+	size_t len, mailbox_msg_cb_t cb, u32 timeout_ms)
 {
 	int rv = 0;
 	struct mailbox *mbx = platform_get_drvdata(pdev);
@@ -1359,13 +1978,16 @@ int mailbox_post(struct platform_device *pdev, u64 reqid, void *buf, size_t len)
 		return -ENOMEM;
 
 	(void) memcpy(msg->mbm_data, buf, len);
-	msg->mbm_cb = dft_post_msg_cb;
+	msg->mbm_cb = cb;
 	msg->mbm_cb_arg = msg;
+	if (timeout_ms)
+		msg->mbm_timeout_ms = timeout_ms;
 	if (reqid) {
 		msg->mbm_req_id = reqid;
 		msg->mbm_flags |= MSG_FLAG_RESPONSE;
 	} else {
 		msg->mbm_req_id = (uintptr_t)msg->mbm_data;
+		mailbox_stat_submit(mbx, msg, true);
 	}
 
 	rv = chan_msg_enqueue(&mbx->mbx_tx, msg);
@@ -1377,6 +1999,36 @@ int mailbox_post(struct platform_device *pdev, u64 reqid, void *buf, size_t len)
 
 	return rv;
 }
+
+int mailbox_post(struct platform_device *pdev, u64 reqid, void *buf, size_t len)
+{
+	return __mailbox_post(pdev, reqid, buf, len, dft_post_msg_cb, 0);
+}
+
+/* SYN timeout for the given retry, doubling up to the cap. */
+static inline u32 mailbox_conn_backoff_ms(u32 retries)
+{
+	return min_t(u32, MAILBOX_CONN_RETRY_MIN_MS << retries,
+		MAILBOX_CONN_RETRY_MAX_MS);
+}
+
+/*
+ * Our SYN did not make it to peer within its backoff timeout. Resend it
+ * right away, see mailbox_conn_retry().
+ */
+static void mailbox_conn_syn_cb(void *arg, void *buf, size_t len, u64 id,
+	int err)
+{
+	struct mailbox_msg *msg = (struct mailbox_msg *)arg;
+	struct mailbox *mbx = msg->mbm_ch->mbc_parent;
+	u32 retries = READ_ONCE(mbx->mbx_conn_retries);
+
+	dft_post_msg_cb(arg, buf, len, id, err);
+	if (!err || err == -ESHUTDOWN || retries >= MAILBOX_CONN_RETRIES)
+		return;
+
+	mod_delayed_work(system_wq, &mbx->mbx_conn_retry, 0);
+}
 /*
  *   should not be called by other than connect_state_handler
  */
@@ -1416,7 +2068,16 @@ static int mailbox_connection_notify(struct platform_device *pdev, uint64_t sec_
 
 	memcpy(mb_req->data, &mb_conn, data_len);
 
-	ret = mailbox_post(pdev, 0, mb_req, reqlen);
+	/*
+	 * Give up on a SYN quickly, it is cheap to send another one. The
+	 * timeout is the backoff, so each retry costs only that much.
+	 */
+	if (flag == MB_CONN_SYN && sec_id == 0)
+		ret = __mailbox_post(pdev, 0, mb_req, reqlen,
+			mailbox_conn_syn_cb,
+			mailbox_conn_backoff_ms(mbx->mbx_conn_retries));
+	else
+		ret = mailbox_post(pdev, 0, mb_req, reqlen);
 
 done:
 	vfree(mb_req);
@@ -1460,6 +2121,9 @@ static int mailbox_get_data(struct platform_device *pdev, enum data_kind kind)
 	case PEER_CONN:
 		ret = mailbox_connect_status(pdev);
 		break;
+	case PEER_PROT_VER:
+		ret = mailbox_peer_prot_ver(pdev);
+		break;
 	default:
 		break;
 	}
@@ -1481,19 +2145,23 @@ static void connect_state_handler(struct mailbox *mbx, struct mailbox_conn *conn
 		case MB_CONN_INIT:
 			/* clean up all cached data, */
 			mbx->mbx_paired = 0;
+			mbx->mbx_peer_prot_ver = 0;
 			mbx->mbx_established = false;
 			if (mbx->mbx_kaddr)
 				kfree(mbx->mbx_kaddr);
 
 			mbx->mbx_kaddr = kzalloc(PAGE_SIZE, GFP_KERNEL);
 			get_random_bytes(mbx->mbx_kaddr, PAGE_SIZE);
+			mbx->mbx_conn_retries = 0;
 			ret = mailbox_connection_notify(mbx->mbx_pdev, 0, MB_CONN_SYN);
 			if (ret)
 				goto done;
 			mbx->mbx_state = CONN_SYN_SENT;
+			mbx->mbx_conn_start = ktime_get();
 			break;
 		case MB_CONN_SYN:
 			if (mbx->mbx_state == CONN_SYN_SENT) {
+				mbx->mbx_peer_prot_ver = conn->ver;
 				if (!mailbox_connection_explore(mbx->mbx_pdev, conn)) {
 					mbx->mbx_paired |= 0x2;
 					MBX_INFO(mbx, "mailbox mbx_prot_ver %x", mbx->mbx_prot_ver);
@@ -1511,6 +2179,8 @@ static void connect_state_handler(struct mailbox *mbx, struct mailbox_conn *conn
 					mbx->mbx_paired |= 0x1;
 					mbx->mbx_established = true;
 					mbx->mbx_state = CONN_ESTABLISH;
+					mbx->mbx_conn_us = ktime_us_delta(ktime_get(),
+						mbx->mbx_conn_start);
 					kfree(mbx->mbx_kaddr);
 					mbx->mbx_kaddr = NULL;
 				} else
@@ -1519,6 +2189,7 @@ static void connect_state_handler(struct mailbox *mbx, struct mailbox_conn *conn
 			break;
 		case MB_CONN_FIN:
 			mbx->mbx_paired = 0;
+			mbx->mbx_peer_prot_ver = 0;
 			mbx->mbx_established = false;
 			if (mbx->mbx_kaddr) {
 				kfree(mbx->mbx_kaddr);
@@ -1540,6 +2211,28 @@ static void connect_state_handler(struct mailbox *mbx, struct mailbox_conn *conn
 	MBX_INFO(mbx, "mailbox connection state %d", mbx->mbx_paired);
 }
 
+/*
+ * Resend our SYN as soon as the previous one timed out, so a peer that
+ * came up a little later, or lost the first SYN to a reset, pairs up
+ * without waiting for it to send its own SYN. Only a SYN that never left
+ * is resent: a duplicate SYN would make peer restart the handshake.
+ */
+static void mailbox_conn_retry(struct work_struct *work)
+{
+	struct mailbox *mbx = container_of(to_delayed_work(work),
+		struct mailbox, mbx_conn_retry);
+
+	mutex_lock(&mbx->mbx_lock);
+	if (mbx->mbx_state == CONN_SYN_SENT && mbx->mbx_kaddr &&
+		mbx->mbx_conn_retries < MAILBOX_CONN_RETRIES) {
+		mbx->mbx_conn_retries++;
+		MBX_DBG(mbx, "resending SYN, retry %d", mbx->mbx_conn_retries);
+		(void) mailbox_connection_notify(mbx->mbx_pdev, 0,
+			MB_CONN_SYN);
+	}
+	mutex_unlock(&mbx->mbx_lock);
+}
+
 static void process_request(struct mailbox *mbx, struct mailbox_msg *msg)
 {
 	struct mailbox_req *req = (struct mailbox_req *)msg->mbm_data;
@@ -1699,13 +2392,14 @@ static void mailbox_disable_intr_mode(struct mailbox *mbx)
 	mailbox_reg_wr(mbx, &mbx->mbx_regs->mbr_rit, 0x0);
 	mailbox_reg_wr(mbx, &mbx->mbx_regs->mbr_sit, 0x0);
 
-	if (mbx->mbx_irq == -1)
-		return;
-
-	(void) xocl_user_interrupt_config(xdev, mbx->mbx_irq, false);
-	(void) xocl_user_interrupt_reg(xdev, mbx->mbx_irq, NULL, mbx);
+	if (mbx->mbx_irq != -1) {
+		(void) xocl_user_interrupt_config(xdev, mbx->mbx_irq, false);
+		(void) xocl_user_interrupt_reg(xdev, mbx->mbx_irq, NULL, mbx);
+		mbx->mbx_irq = -1;
+	}
 
-	mbx->mbx_irq = -1;
+	chan_poll_kick(&mbx->mbx_rx);
+	chan_poll_kick(&mbx->mbx_tx);
 }
 
 int mailbox_reset(struct platform_device *pdev, bool end_of_reset)
@@ -1713,10 +2407,9 @@ int mailbox_reset(struct platform_device *pdev, bool end_of_reset)
 	struct mailbox *mbx = platform_get_drvdata(pdev);
 	int ret = 0;
 
-	if (mailbox_no_intr)
-		return 0;
-
-	if (end_of_reset) {
+	if (mailbox_no_intr) {
+		/* Nothing to switch, just pair up again. */
+	} else if (end_of_reset) {
 		MBX_INFO(mbx, "enable intr mode");
 		if (mailbox_enable_intr_mode(mbx) != 0)
 			MBX_ERR(mbx, "failed to enable intr after reset");
@@ -1724,6 +2417,10 @@ int mailbox_reset(struct platform_device *pdev, bool end_of_reset)
 		MBX_INFO(mbx, "enable polling mode");
 		mailbox_disable_intr_mode(mbx);
 	}
+
+	/* Peer may have been reset too, redo the handshake right away. */
+	if (end_of_reset)
+		connect_state_touch(mbx, MB_CONN_INIT);
 	return ret;
 }
 
@@ -1747,17 +2444,27 @@ static int mailbox_remove(struct platform_device *pdev)
 	mailbox_disable_intr_mode(mbx);
 
 	sysfs_remove_group(&pdev->dev.kobj, &mailbox_attrgroup);
+	if (mbx->mbx_sw)
+		sysfs_remove_group(&pdev->dev.kobj, &mailbox_lb_attrgroup);
 
 	chan_fini(&mbx->mbx_rx);
 	chan_fini(&mbx->mbx_tx);
 	listen_wq_fini(mbx);
+	/* No more SYN can fail from here on. */
+	cancel_delayed_work_sync(&mbx->mbx_conn_retry);
 
 	BUG_ON(!(list_empty(&mbx->mbx_req_list)));
 
-	xocl_subdev_register(pdev, XOCL_SUBDEV_MAILBOX, NULL);
-
-	if (mbx->mbx_regs)
-		iounmap(mbx->mbx_regs);
+	if (mbx->mbx_sw) {
+		spin_lock(&mbx->mbx_sw->msw_lock);
+		mbx->mbx_sw->msw_end[mbx->mbx_sw_end] = NULL;
+		spin_unlock(&mbx->mbx_sw->msw_lock);
+		kfree(mbx->mbx_regs);
+	} else {
+		xocl_subdev_register(pdev, XOCL_SUBDEV_MAILBOX, NULL);
+		if (mbx->mbx_regs)
+			iounmap(mbx->mbx_regs);
+	}
 
 	MBX_INFO(mbx, "mailbox cleaned up successfully");
 	platform_set_drvdata(pdev, NULL);
@@ -1765,6 +2472,191 @@ static int mailbox_remove(struct platform_device *pdev)
 	return 0;
 }
 
+static u32 mailbox_sw_reg_rd(struct mailbox *mbx, u32 *reg)
+{
+	struct mailbox_sw_wire *wire = mbx->mbx_sw;
+	struct mailbox_sw_fifo *tx = &wire->msw_fifo[mbx->mbx_sw_end];
+	struct mailbox_sw_fifo *rx = &wire->msw_fifo[!mbx->mbx_sw_end];
+	struct mailbox *peer;
+	u32 val = 0;
+
+	spin_lock(&wire->msw_lock);
+	if (reg == &mbx->mbx_regs->mbr_rddata) {
+		if (rx->msf_cnt == 0) {
+			mbx->mbx_sw_err |= STATUS_EMPTY;
+		} else {
+			val = rx->msf_data[rx->msf_head];
+			rx->msf_head = (rx->msf_head + 1) % MAILBOX_SW_FIFO_DEPTH;
+			rx->msf_cnt--;
+			/* Drained, let the sender know. */
+			peer = wire->msw_end[!mbx->mbx_sw_end];
+			if (rx->msf_cnt == 0 && peer)
+				complete(&peer->mbx_tx.mbc_worker);
+		}
+	} else if (reg == &mbx->mbx_regs->mbr_status) {
+		if (rx->msf_cnt == 0)
+			val |= STATUS_EMPTY;
+		if (tx->msf_cnt == MAILBOX_SW_FIFO_DEPTH)
+			val |= STATUS_FULL;
+		if (tx->msf_cnt <= mbx->mbx_regs->mbr_sit)
+			val |= STATUS_STA;
+		if (rx->msf_cnt > mbx->mbx_regs->mbr_rit)
+			val |= STATUS_RTA;
+	} else if (reg == &mbx->mbx_regs->mbr_error) {
+		val = mbx->mbx_sw_err;
+		mbx->mbx_sw_err = 0;
+	} else if (reg != &mbx->mbx_regs->mbr_wrdata) {
+		val = *reg;
+	}
+	spin_unlock(&wire->msw_lock);
+
+	return val;
+}
+
+static void mailbox_sw_reg_wr(struct mailbox *mbx, u32 *reg, u32 val)
+{
+	struct mailbox_sw_wire *wire = mbx->mbx_sw;
+	struct mailbox_sw_fifo *tx = &wire->msw_fifo[mbx->mbx_sw_end];
+	struct mailbox *peer;
+
+	spin_lock(&wire->msw_lock);
+	if (reg == &mbx->mbx_regs->mbr_wrdata) {
+		if (tx->msf_cnt == MAILBOX_SW_FIFO_DEPTH) {
+			mbx->mbx_sw_err |= STATUS_FULL;
+		} else {
+			tx->msf_data[(tx->msf_head + tx->msf_cnt) %
+				MAILBOX_SW_FIFO_DEPTH] = val;
+			tx->msf_cnt++;
+			/* A whole packet is in, wake up the receiver. */
+			peer = wire->msw_end[!mbx->mbx_sw_end];
+			if ((tx->msf_cnt % PACKET_SIZE) == 0 && peer)
+				complete(&peer->mbx_rx.mbc_worker);
+		}
+	} else if (reg == &mbx->mbx_regs->mbr_ctrl) {
+		/* Reset TX FIFO. */
+		if (val & 0x1) {
+			tx->msf_head = 0;
+			tx->msf_cnt = 0;
+		}
+	} else if (reg != &mbx->mbx_regs->mbr_rddata &&
+		reg != &mbx->mbx_regs->mbr_status &&
+		reg != &mbx->mbx_regs->mbr_error) {
+		*reg = val;
+	}
+	spin_unlock(&wire->msw_lock);
+}
+
+/* Loopback ends echo back whatever request they are given. */
+static void mailbox_lb_echo(void *arg, void *data, size_t len, u64 msgid,
+	int err)
+{
+	struct mailbox *mbx = (struct mailbox *)arg;
+
+	if (err == 0)
+		(void) mailbox_post(mbx->mbx_pdev, msgid, data, len);
+}
+
+static ssize_t mailbox_bench_show(struct device *dev,
+	struct device_attribute *attr, char *buf)
+{
+	struct platform_device *pdev = to_platform_device(dev);
+	struct mailbox *mbx = platform_get_drvdata(pdev);
+	u64 us = max_t(s64, mbx->mbx_bench_us, 1);
+
+	return sprintf(buf, "msgs %u len %zu usecs %lld err %d "
+		"msgs/s %llu bytes/s %llu\n",
+		mbx->mbx_bench_msgs, mbx->mbx_bench_len, mbx->mbx_bench_us,
+		mbx->mbx_bench_err,
+		div64_u64((u64)mbx->mbx_bench_msgs * USEC_PER_SEC, us),
+		div64_u64((u64)mbx->mbx_bench_msgs * mbx->mbx_bench_len * 2 *
+		USEC_PER_SEC, us));
+}
+
+static ssize_t mailbox_bench_store(struct device *dev,
+	struct device_attribute *da, const char *buf, size_t count)
+{
+	struct platform_device *pdev = to_platform_device(dev);
+	struct mailbox *mbx = platform_get_drvdata(pdev);
+	struct mailbox_req *req;
+	char *resp;
+	size_t len, resplen;
+	u32 msgs, i;
+	ktime_t start;
+	int ret = 0;
+
+	if (sscanf(buf, "%u %zu", &msgs, &len) != 2 || msgs == 0 ||
+		len < sizeof(struct mailbox_req) ||
+		len > MAILBOX_BENCH_MAX_LEN) {
+		MBX_ERR(mbx, "input should be <msgs> <len in [%zu, %d]>",
+			sizeof(struct mailbox_req), MAILBOX_BENCH_MAX_LEN);
+		return -EINVAL;
+	}
+
+	req = vzalloc(len);
+	resp = vmalloc(len);
+	if (!req || !resp) {
+		vfree(req);
+		vfree(resp);
+		return -ENOMEM;
+	}
+	req->req = MAILBOX_REQ_UNKNOWN;
+
+	start = ktime_get();
+	for (i = 0; i < msgs && ret == 0; i++) {
+		resplen = len;
+		ret = mailbox_request(pdev, req, len, resp, &resplen,
+			NULL, NULL, 0);
+		if (ret == 0 && resplen != len)
+			ret = -EIO;
+	}
+	mbx->mbx_bench_us = ktime_us_delta(ktime_get(), start);
+	mbx->mbx_bench_msgs = ret ? i - 1 : i;
+	mbx->mbx_bench_len = len;
+	mbx->mbx_bench_err = ret;
+
+	vfree(req);
+	vfree(resp);
+	return ret ? ret : count;
+}
+/* Request / response benchmark on loopback mailbox: <msgs> <len>. */
+static DEVICE_ATTR_RW(mailbox_bench);
+
+static struct attribute *mailbox_lb_attrs[] = {
+	&dev_attr_mailbox_bench.attr,
+	NULL,
+};
+
+static const struct attribute_group mailbox_lb_attrgroup = {
+	.attrs = mailbox_lb_attrs,
+};
+
+/*
+ * Allow one queued peer request per page of 1/1024 of system memory, unless
+ * the admin set a fixed queue length. Queued bytes may go up to that budget
+ * but never default below MAX_MSG_QUEUE_SZ, so a whole xclbin still fits.
+ */
+static void mailbox_req_queue_init(struct mailbox *mbx)
+{
+	struct sysinfo si;
+	u64 budget;
+
+	si_meminfo(&si);
+	budget = ((u64)si.totalram * si.mem_unit) >> 10;
+	mbx->mbx_req_max_sz = max_t(u64, budget, MAX_MSG_QUEUE_SZ);
+
+	if (mailbox_req_queue_len) {
+		mbx->mbx_req_max_cnt = min_t(u32, mailbox_req_queue_len,
+			MAX_MSG_QUEUE_LEN);
+	} else {
+		mbx->mbx_req_max_cnt = clamp_t(u32, budget >> PAGE_SHIFT,
+			MIN_MSG_QUEUE_LEN, MAX_MSG_QUEUE_LEN);
+	}
+	mbx->mbx_req_rejected = 0;
+
+	MBX_INFO(mbx, "request queue limit %u msgs, %zu bytes",
+		mbx->mbx_req_max_cnt, mbx->mbx_req_max_sz);
+}
+
 static int mailbox_probe(struct platform_device *pdev)
 {
 	struct mailbox *mbx = NULL;
@@ -1781,17 +2673,35 @@ static int mailbox_probe(struct platform_device *pdev)
 
 	init_completion(&mbx->mbx_comp);
 	mutex_init(&mbx->mbx_lock);
+	spin_lock_init(&mbx->mbx_stat_lock);
 	INIT_LIST_HEAD(&mbx->mbx_req_list);
 	mbx->mbx_req_cnt = 0;
 	mbx->mbx_req_sz = 0;
+	mailbox_req_queue_init(mbx);
 
 	mutex_init(&mbx->mbx_conn_lock);
+	INIT_DELAYED_WORK(&mbx->mbx_conn_retry, mailbox_conn_retry);
+	mbx->mbx_conn_us = -1;
 	mbx->mbx_established = false;
 	mbx->mbx_conn_id = 0;
 	mbx->mbx_kaddr = NULL;
 
-	res = platform_get_resource(pdev, IORESOURCE_MEM, 0);
-	mbx->mbx_regs = ioremap_nocache(res->start, res->end - res->start + 1);
+	if (platform_get_device_id(pdev)->driver_data) {
+		struct mailbox_lb_pdata *pdata = dev_get_platdata(&pdev->dev);
+
+		mbx->mbx_regs = kzalloc(sizeof(struct mailbox_reg),
+			GFP_KERNEL);
+		if (!mbx->mbx_regs) {
+			ret = -ENOMEM;
+			goto failed;
+		}
+		mbx->mbx_sw = pdata->wire;
+		mbx->mbx_sw_end = pdata->end;
+	} else {
+		res = platform_get_resource(pdev, IORESOURCE_MEM, 0);
+		mbx->mbx_regs = ioremap_nocache(res->start,
+			res->end - res->start + 1);
+	}
 	if (!mbx->mbx_regs) {
 		MBX_ERR(mbx, "failed to map in registers");
 		ret = -EIO;
@@ -1827,7 +2737,21 @@ static int mailbox_probe(struct platform_device *pdev)
 		goto failed;
 	}
 
-	if (mailbox_no_intr) {
+	if (mbx->mbx_sw) {
+		ret = sysfs_create_group(&pdev->dev.kobj,
+			&mailbox_lb_attrgroup);
+		if (ret != 0) {
+			MBX_ERR(mbx, "failed to init loopback sysfs");
+			goto failed;
+		}
+		mbx->mbx_listen_cb = mailbox_lb_echo;
+		mbx->mbx_listen_cb_arg = mbx;
+		spin_lock(&mbx->mbx_sw->msw_lock);
+		mbx->mbx_sw->msw_end[mbx->mbx_sw_end] = mbx;
+		spin_unlock(&mbx->mbx_sw->msw_lock);
+	}
+
+	if (mailbox_no_intr || mbx->mbx_sw) {
 		MBX_INFO(mbx, "Enabled timer-driven mode");
 		mailbox_disable_intr_mode(mbx);
 	} else {
@@ -1836,10 +2760,11 @@ static int mailbox_probe(struct platform_device *pdev)
 			goto failed;
 	}
 
-	xocl_subdev_register(pdev, XOCL_SUBDEV_MAILBOX, &mailbox_ops);
+	if (!mbx->mbx_sw)
+		xocl_subdev_register(pdev, XOCL_SUBDEV_MAILBOX, &mailbox_ops);
 
-	connect_state_touch(mbx, MB_CONN_INIT);
 	mbx->mbx_prot_ver = MB_PROTOCOL_VER;
+	connect_state_touch(mbx, MB_CONN_INIT);
 
 	MBX_INFO(mbx, "successfully initialized");
 	return 0;
@@ -1851,6 +2776,7 @@ static int mailbox_probe(struct platform_device *pdev)
 
 struct platform_device_id mailbox_id_table[] = {
 	{ XOCL_MAILBOX, 0 },
+	{ MAILBOX_LB_NAME, 1 },
 	{ },
 };
 
@@ -1863,13 +2789,66 @@ static struct platform_driver mailbox_driver = {
 	.id_table = mailbox_id_table,
 };
 
+static struct mailbox_sw_wire *mailbox_lb_wire;
+
+static void mailbox_lb_fini(void)
+{
+	int i;
+
+	if (!mailbox_lb_wire)
+		return;
+
+	for (i = 0; i < 2; i++) {
+		if (mailbox_lb_wire->msw_pdev[i])
+			platform_device_unregister(mailbox_lb_wire->msw_pdev[i]);
+	}
+	vfree(mailbox_lb_wire);
+	mailbox_lb_wire = NULL;
+}
+
+static int mailbox_lb_init(void)
+{
+	struct mailbox_lb_pdata pdata;
+	struct platform_device *pldev;
+	int i;
+
+	mailbox_lb_wire = vzalloc(sizeof(*mailbox_lb_wire));
+	if (!mailbox_lb_wire)
+		return -ENOMEM;
+	spin_lock_init(&mailbox_lb_wire->msw_lock);
+
+	pdata.wire = mailbox_lb_wire;
+	for (i = 0; i < 2; i++) {
+		pdata.end = i;
+		pldev = platform_device_register_data(NULL, MAILBOX_LB_NAME,
+			PLATFORM_DEVID_AUTO, &pdata, sizeof(pdata));
+		if (IS_ERR(pldev)) {
+			mailbox_lb_fini();
+			return PTR_ERR(pldev);
+		}
+		mailbox_lb_wire->msw_pdev[i] = pldev;
+	}
+
+	return 0;
+}
+
 int __init xocl_init_mailbox(void)
 {
+	int ret;
+
 	BUILD_BUG_ON(sizeof(struct mailbox_pkt) != sizeof(u32) * PACKET_SIZE);
-	return platform_driver_register(&mailbox_driver);
+	ret = platform_driver_register(&mailbox_driver);
+	if (ret || !mailbox_loopback)
+		return ret;
+
+	ret = mailbox_lb_init();
+	if (ret)
+		platform_driver_unregister(&mailbox_driver);
+	return ret;
 }
 
 void xocl_fini_mailbox(void)
 {
+	mailbox_lb_fini();
 	platform_driver_unregister(&mailbox_driver);
 }
@@ -83,6 +83,14 @@
 # define SCHED_DEBUG_PACKET(packet, size)
 #endif
 
+static unsigned int kds_energy_interval_ms;
+module_param(kds_energy_interval_ms, uint, (S_IRUGO|S_IWUSR));
+MODULE_PARM_DESC(kds_energy_interval_ms,
+	"Interval (ms) at which board power is sampled and attributed to clients while any is open, penguin mode only (0 = off (default), 100 - 10000)");
+
+#define	KDS_ENERGY_INTERVAL_MIN_MS	100
+#define	KDS_ENERGY_INTERVAL_MAX_MS	10000
+
 /* constants */
 static const unsigned int no_index = -1;
 
@@ -185,6 +193,7 @@ slot_idx_in_mask(unsigned int slot_idx)
  * @chain: list of commands to trigger upon completion; maximum chain depth is 8
  * @deps: list of commands this object depends on, converted to chain when command is queued
  * @packet: mapped ert packet object from user space
+ * @busy: command occupies a CU and counts towards client CU busy time
  */
 struct xocl_cmd {
 	struct list_head cq_list; // scheduler command queue
@@ -216,6 +225,7 @@ struct xocl_cmd {
 	unsigned long uid;     // unique id for this command
 	unsigned int cu_idx;   // index of CU running this cmd (penguin mode)
 	unsigned int slot_idx; // index in exec core submit queue
+	bool busy;             // counted in client energy_running
 };
 
 /*
@@ -539,11 +549,54 @@ cmd_get(struct xocl_scheduler *xs, struct exec_core *exec, struct client_ctx *cl
 	xcmd->client = client;
 	xcmd->bo = NULL;
 	xcmd->ecmd = NULL;
+	xcmd->busy = false;
 	atomic_inc(&client->outstanding_execs);
 	SCHED_DEBUGF("xcmd(%lu) xcmd(%p) [-> new ]\n", xcmd->uid, xcmd);
 	return xcmd;
 }
 
+/*
+ * client_energy_busy() - Account a change in CUs occupied by a client
+ *
+ * @delta: +1 when a command of the client starts on a CU, -1 when it leaves
+ *
+ * The busy time integral (number of occupied CUs over time) is what the
+ * energy tick uses to split board energy between clients.
+ */
+static void
+client_energy_busy(struct client_ctx *client, int delta)
+{
+	u64 now = ktime_get_ns();
+
+	spin_lock(&client->energy_lock);
+	client->energy_busy_ns += (u64)client->energy_running *
+		(now - client->energy_ts);
+	client->energy_ts = now;
+	client->energy_running += delta;
+	spin_unlock(&client->energy_lock);
+}
+
+static inline void
+cmd_busy_start(struct xocl_cmd *xcmd)
+{
+	u32 opcode = cmd_opcode(xcmd);
+
+	if (cmd_type(xcmd) == ERT_CTRL ||
+	    (opcode != ERT_START_CU && opcode != ERT_START_COPYBO))
+		return;
+	xcmd->busy = true;
+	client_energy_busy(xcmd->client, 1);
+}
+
+static inline void
+cmd_busy_end(struct xocl_cmd *xcmd)
+{
+	if (!xcmd->busy)
+		return;
+	xcmd->busy = false;
+	client_energy_busy(xcmd->client, -1);
+}
+
 /**
  * cmd_free() - free a command object
  *
@@ -554,6 +607,7 @@ cmd_get(struct xocl_scheduler *xs, struct exec_core *exec, struct client_ctx *cl
 static void
 cmd_free(struct xocl_cmd *xcmd)
 {
+	cmd_busy_end(xcmd);
 	cmd_release_gem_object_reference(xcmd);
 
 	mutex_lock(&free_cmds_mutex);
@@ -944,6 +998,11 @@ static struct exec_ops penguin_ops;
  * @sr2: If set, then status register [64..95] is pending with completed commands (ERT only).
  * @sr3: If set, then status register [96..127] is pending with completed commands (ERT only).
  * @ops: Scheduler operations vtable
+ * @energy_work: Periodic board power sampling and energy attribution
+ * @energy_ts: Time (ns) of the last energy tick
+ * @energy_power_mw: Board power seen at the last energy tick
+ * @energy_uj: Cumulative board energy sampled while clients were open
+ * @energy_idle_uj: Part of energy_uj when no client had a CU busy
  */
 struct exec_core {
 	struct platform_device	   *pdev;
@@ -992,6 +1051,13 @@ struct exec_core {
 
 	unsigned int		   uid;
 	unsigned int		   ip_reference[MAX_CUS];
+
+	// Energy accounting, protected by xdev->ctx_list_lock
+	struct delayed_work	   energy_work;
+	u64			   energy_ts;
+	u32			   energy_power_mw;
+	u64			   energy_uj;
+	u64			   energy_idle_uj;
 };
 
 /**
@@ -1308,6 +1374,74 @@ exec_isr(int irq, void *arg)
 	return IRQ_HANDLED;
 }
 
+static inline unsigned long
+exec_energy_interval(void)
+{
+	if (!kds_energy_interval_ms)
+		return 0;
+
+	return msecs_to_jiffies(clamp_t(unsigned int, kds_energy_interval_ms,
+		KDS_ENERGY_INTERVAL_MIN_MS, KDS_ENERGY_INTERVAL_MAX_MS));
+}
+
+/*
+ * exec_energy_tick() - Integrate board power and attribute it to clients
+ *
+ * Energy of the interval since the last tick is power (from XMC) times
+ * elapsed time. It is split between client contexts by their share of CU
+ * busy time in the same interval. Energy spent while no CU was busy is
+ * only counted as idle. CU busy time is only known in penguin mode, with
+ * ERT all energy is counted as idle.
+ */
+static void
+exec_energy_tick(struct work_struct *work)
+{
+	struct exec_core *exec = container_of(to_delayed_work(work),
+		struct exec_core, energy_work);
+	struct xocl_dev *xdev = exec_get_xdev(exec);
+	struct client_ctx *entry;
+	u64 now, busy, total_us = 0, uj;
+	unsigned long ival = exec_energy_interval();
+	u32 mw;
+
+	/* May wait for mgmt pf on user pf, so not under any lock. */
+	if (xocl_xmc_get_power(xdev, &mw))
+		mw = 0;
+
+	mutex_lock(&xdev->ctx_list_lock);
+	now = ktime_get_ns();
+	uj = div_u64((u64)mw * (now - exec->energy_ts), NSEC_PER_MSEC);
+	exec->energy_ts = now;
+
+	list_for_each_entry(entry, &xdev->ctx_list, link) {
+		spin_lock(&entry->energy_lock);
+		now = ktime_get_ns();
+		busy = entry->energy_busy_ns + (u64)entry->energy_running *
+			(now - entry->energy_ts);
+		entry->energy_busy_ns = 0;
+		entry->energy_ts = now;
+		spin_unlock(&entry->energy_lock);
+
+		entry->energy_tick_us = div_u64(busy, NSEC_PER_USEC);
+		total_us += entry->energy_tick_us;
+	}
+
+	if (total_us) {
+		list_for_each_entry(entry, &xdev->ctx_list, link)
+			entry->energy_uj += div64_u64(uj * entry->energy_tick_us,
+				total_us);
+	} else {
+		exec->energy_idle_uj += uj;
+	}
+	exec->energy_uj += uj;
+	exec->energy_power_mw = mw;
+
+	/* Stops with the last client, see destroy_client(). */
+	if (!list_empty(&xdev->ctx_list) && ival)
+		schedule_delayed_work(&exec->energy_work, ival);
+	mutex_unlock(&xdev->ctx_list_lock);
+}
+
 /*
  */
 struct exec_core *
@@ -1341,6 +1475,8 @@ exec_create(struct platform_device *pdev, struct xocl_scheduler *xs)
 	exec_reset(exec);
 	platform_set_drvdata(pdev, exec);
 
+	INIT_DELAYED_WORK(&exec->energy_work, exec_energy_tick);
+
 	SCHED_DEBUGF("%s(%d)\n", __func__, exec->uid);
 
 	return exec;
@@ -1354,6 +1490,7 @@ exec_destroy(struct exec_core *exec)
 	int idx;
 
 	SCHED_DEBUGF("%s(%d)\n", __func__, exec->uid);
+	cancel_delayed_work_sync(&exec->energy_work);
 	for (idx = 0; idx < exec->num_cus; ++idx)
 		cu_destroy(exec->cus[idx]);
 	if (exec->ert)
@@ -1709,6 +1846,13 @@ exec_start_cmd(struct exec_core *exec, struct xocl_cmd *xcmd)
 
 	if (exec->ops->start(exec, xcmd)) {
 		cmd_set_int_state(xcmd, ERT_CMD_STATE_RUNNING);
+		/*
+		 * In ERT mode start only queues the cmd into a CQ slot, when
+		 * it reaches a CU is not known. Only penguin mode, where the
+		 * cmd is on a CU once started, accounts CU busy time.
+		 */
+		if (!exec_is_ert(exec))
+			cmd_busy_start(xcmd);
 		return true;
 	}
 
@@ -2350,7 +2494,9 @@ static int
 create_client(struct platform_device *pdev, void **priv)
 {
 	struct client_ctx	*client;
+	struct exec_core	*exec = platform_get_drvdata(pdev);
 	struct xocl_dev		*xdev = xocl_get_xdev(pdev);
+	unsigned long		ival = exec_energy_interval();
 	int			ret = 0;
 
 	client = devm_kzalloc(&pdev->dev, sizeof(*client), GFP_KERNEL);
@@ -2367,7 +2513,14 @@ create_client(struct platform_device *pdev, void **priv)
 		atomic_set(&client->trigger, 0);
 		atomic_set(&client->outstanding_execs, 0);
 		client->num_cus = 0;
+		spin_lock_init(&client->energy_lock);
+		client->energy_ts = ktime_get_ns();
 		client->xdev = xocl_get_xdev(pdev);
+		/* First client starts energy sampling if it is enabled. */
+		if (list_empty(&xdev->ctx_list) && ival) {
+			exec->energy_ts = client->energy_ts;
+			schedule_delayed_work(&exec->energy_work, ival);
+		}
 		list_add_tail(&client->link, &xdev->ctx_list);
 		*priv =	 client;
 	} else {
@@ -2439,12 +2592,19 @@ static void destroy_client(struct platform_device *pdev, void **priv)
 		outstanding = new;
 	}
 
-	DRM_INFO("client exits pid(%d)\n", pid);
-
 	mutex_lock(&xdev->ctx_list_lock);
 	list_del(&client->link);
+	/*
+	 * A tick already running waits for ctx_list_lock and won't re-arm
+	 * once it sees the list empty, so no need to sync here.
+	 */
+	if (list_empty(&xdev->ctx_list))
+		cancel_delayed_work(&exec->energy_work);
 	mutex_unlock(&xdev->ctx_list_lock);
 
+	DRM_INFO("client exits pid(%d) energy(%llu uJ)\n", pid,
+		 client->energy_uj);
+
 	if (client->xclbin_locked)
 		xocl_icap_unlock_bitstream(xdev, &client->xclbin_id, pid);
 	mutex_destroy(&client->lock);
@@ -2950,10 +3110,35 @@ kds_custat_show(struct device *dev, struct device_attribute *attr, char *buf)
 }
 static DEVICE_ATTR_RO(kds_custat);
 
+static ssize_t
+kds_energy_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct exec_core *exec = dev_get_exec(dev);
+	struct xocl_dev *xdev = exec_get_xdev(exec);
+	struct client_ctx *entry;
+	ssize_t sz = 0;
+
+	mutex_lock(&xdev->ctx_list_lock);
+	sz += sprintf(buf+sz, "power_mw %u\ntotal_uj %llu\nidle_uj %llu\n",
+		      exec->energy_power_mw, exec->energy_uj,
+		      exec->energy_idle_uj);
+	list_for_each_entry(entry, &xdev->ctx_list, link) {
+		if (sz > PAGE_SIZE - 64)
+			break;
+		sz += sprintf(buf+sz, "pid %d uj %llu\n",
+			      pid_nr(entry->pid), entry->energy_uj);
+	}
+	mutex_unlock(&xdev->ctx_list_lock);
+
+	return sz;
+}
+static DEVICE_ATTR_RO(kds_energy);
+
 static struct attribute *kds_sysfs_attrs[] = {
 	&dev_attr_kds_numcus.attr,
 	&dev_attr_kds_numcdmas.attr,
 	&dev_attr_kds_custat.attr,
+	&dev_attr_kds_energy.attr,
 	NULL
 };
 
@@ -2999,6 +3184,7 @@ static int mb_scheduler_probe(struct platform_device *pdev)
 	return 0;
 
 err:
+	cancel_delayed_work_sync(&exec->energy_work);
 	devm_kfree(&pdev->dev, exec);
 	return 1;
 }
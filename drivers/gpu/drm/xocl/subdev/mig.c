@@ -174,6 +174,60 @@ static int mgmt_sysfs_create_mig(struct platform_device *pdev)
 	return 0;
 }
 
+struct mig_ecc_iter {
+	struct xclmgmt_mig_ecc	*ecc;
+	u32			max;
+	u32			count;
+};
+
+static int mig_get_ecc_one(struct platform_device *pdev, void *data)
+{
+	struct mig_ecc_iter *it = (struct mig_ecc_iter *)data;
+	struct device *dev = &pdev->dev;
+	struct xclmgmt_mig_ecc *ecc;
+	struct xocl_mig *mig;
+	u64 val;
+
+	if (it->count >= it->max)
+		return 1;
+
+	/* Hold off unbind while the registers are read. */
+	device_lock(dev);
+	mig = dev->driver ? dev_get_drvdata(dev) : NULL;
+	if (mig && mig->base) {
+		ecc = &it->ecc[it->count++];
+		strncpy(ecc->tag, XOCL_GET_SUBDEV_PRIV(dev),
+			sizeof(ecc->tag) - 1);
+		ecc->ecc_enabled = ioread32(mig->base + ECC_ON_OFF);
+		ecc->ecc_status = ioread32(mig->base + ECC_STATUS);
+		ecc->ecc_ce_cnt = ioread32(mig->base + CE_CNT);
+		val = ioread32(mig->base + CE_ADDR_HI);
+		ecc->ecc_ce_ffa = (val << 32) | ioread32(mig->base + CE_ADDR_LO);
+		val = ioread32(mig->base + UE_ADDR_HI);
+		ecc->ecc_ue_ffa = (val << 32) | ioread32(mig->base + UE_ADDR_LO);
+	}
+	device_unlock(dev);
+
+	return 0;
+}
+
+/*
+ * Read ECC state of all MIG instances of a device into zeroed entries,
+ * returns the number of entries filled in.
+ */
+int xocl_mig_get_ecc(xdev_handle_t xdev_hdl, struct xclmgmt_mig_ecc *ecc,
+	u32 max)
+{
+	struct mig_ecc_iter it = {
+		.ecc = ecc,
+		.max = max,
+	};
+
+	(void) xocl_subdev_for_each_inst(xdev_hdl, XOCL_SUBDEV_MIG,
+		mig_get_ecc_one, &it);
+	return it.count;
+}
+
 static int mig_probe(struct platform_device *pdev)
 {
 	struct xocl_mig *mig;
@@ -19,6 +19,8 @@
 #include <linux/hwmon-sysfs.h>
 #include <linux/vmalloc.h>
 #include <linux/string.h>
+#include <linux/kthread.h>
+#include <linux/hrtimer.h>
 #include "../ert.h"
 #include "../xocl_drv.h"
 #include <drm/xmgmt_drm.h>
@@ -29,6 +31,33 @@
 
 #define	MAX_IMAGE_LEN	0x20000
 
+static unsigned int xmc_sensor_cache_ms = 1000;
+module_param(xmc_sensor_cache_ms, uint, (S_IRUGO|S_IWUSR));
+MODULE_PARM_DESC(xmc_sensor_cache_ms,
+	"How long (ms) a sensor snapshot from mgmt pf is served from cache");
+
+static unsigned int xmc_sample_hz;
+module_param(xmc_sample_hz, uint, (S_IRUGO|S_IWUSR));
+MODULE_PARM_DESC(xmc_sample_hz,
+	"Rate (Hz) of the mgmt pf sensor sampler started at probe (0 = off, default, 1000 = max)");
+
+static unsigned int xmc_sample_ring_len = 1024;
+module_param(xmc_sample_ring_len, uint, (S_IRUGO|S_IWUSR));
+MODULE_PARM_DESC(xmc_sample_ring_len,
+	"Number of samples kept by the mgmt pf sensor sampler (16 - 65536, default 1024)");
+
+static unsigned int xmc_sample_window_ms = 1000;
+module_param(xmc_sample_window_ms, uint, (S_IRUGO|S_IWUSR));
+MODULE_PARM_DESC(xmc_sample_window_ms,
+	"Window (ms) over which sensor_stats reports min/max/avg (default 1000)");
+
+#define	XMC_SAMPLE_HZ_MAX		1000
+#define	XMC_SAMPLE_RING_MIN		16
+#define	XMC_SAMPLE_RING_MAX		65536
+#define	XMC_SAMPLE_SLACK_NS		(50 * NSEC_PER_USEC)
+/* Samples copied out of the ring per smp_lock hold by sensor_stats. */
+#define	XMC_SAMPLE_BATCH		32
+
 #define XMC_MAGIC_REG               0x0
 #define XMC_VERSION_REG             0x4
 #define XMC_STATUS_REG              0x8
@@ -159,31 +188,231 @@ struct xocl_xmc {
 	u32			sche_binary_length;
 	char			*mgmt_binary;
 	u32			mgmt_binary_length;
+
+	/* User pf only, sensors last fetched from mgmt pf. */
+	struct mailbox_sensor_snapshot peer_snap;
+	unsigned long		peer_snap_ts;
+	bool			peer_snap_valid;
+
+	/* Mgmt pf only, sensor sampler and its ring of samples. */
+	struct mutex		smp_ctl_lock;
+	struct task_struct	*smp_thread;
+	unsigned int		smp_hz;
+	spinlock_t		smp_lock;
+	struct xclmgmt_sensor_sample *smp_ring;
+	u32			smp_len;
+	u32			smp_head;
+	u32			smp_cnt;
+	u64			smp_seq;
 };
 
 
 static int load_xmc(struct xocl_xmc *xmc);
 static int stop_xmc(struct platform_device *pdev);
 
-static void xmc_read_from_peer(struct platform_device *pdev, enum data_kind kind, void *resp, size_t resplen)
+static int xmc_read_from_peer(struct platform_device *pdev, enum data_kind kind, void *resp, size_t *resplen)
 {
 	struct mailbox_subdev_peer subdev_peer = {0};
 	size_t data_len = sizeof(struct mailbox_subdev_peer);
 	struct mailbox_req *mb_req = NULL;
 	size_t reqlen = sizeof(struct mailbox_req) + data_len;
+	int ret;
 
 	mb_req = (struct mailbox_req *)vmalloc(reqlen);
 	if (!mb_req)
-		return;
+		return -ENOMEM;
 
 	mb_req->req = MAILBOX_REQ_PEER_DATA;
 
 	subdev_peer.kind = kind;
 	memcpy(mb_req->data, &subdev_peer, data_len);
 
-	(void) xocl_peer_request(XOCL_PL_DEV_TO_XDEV(pdev),
-		mb_req, reqlen, resp, &resplen, NULL, NULL);
+	ret = xocl_peer_request(XOCL_PL_DEV_TO_XDEV(pdev),
+		mb_req, reqlen, resp, resplen, NULL, NULL);
 	vfree(mb_req);
+	return ret;
+}
+
+static bool xmc_peer_snapshot_supported(struct xocl_xmc *xmc)
+{
+	return xocl_mailbox_get_data(XOCL_PL_DEV_TO_XDEV(xmc->pdev),
+		PEER_PROT_VER) >= MB_PROT_VER_SENSOR_SNAPSHOT;
+}
+
+/*
+ * Fetch all sensors from mgmt pf in one request, unless the last snapshot
+ * is recent enough. Should be called with xmc_lock held.
+ */
+static int xmc_peer_snapshot_refresh(struct xocl_xmc *xmc)
+{
+	size_t len = sizeof(xmc->peer_snap);
+	int ret;
+
+	if (xmc->peer_snap_valid && time_before(jiffies, xmc->peer_snap_ts +
+		msecs_to_jiffies(xmc_sensor_cache_ms)))
+		return 0;
+
+	if (!xmc_peer_snapshot_supported(xmc))
+		return -EOPNOTSUPP;
+
+	ret = xmc_read_from_peer(xmc->pdev, SENSOR_SNAPSHOT, &xmc->peer_snap,
+		&len);
+	if (ret == 0 && len != sizeof(xmc->peer_snap))
+		ret = -EPROTO;
+
+	xmc->peer_snap_valid = (ret == 0);
+	xmc->peer_snap_ts = jiffies;
+	return ret;
+}
+
+/* Copy out the sensor register block, mgmt pf only. */
+static int xmc_get_sensors(struct platform_device *pdev, u32 *buf, size_t len)
+{
+	struct xocl_xmc *xmc = platform_get_drvdata(pdev);
+	int ret = 0;
+	u32 off;
+
+	if (!xmc)
+		return -ENODEV;
+
+	mutex_lock(&xmc->xmc_lock);
+	if (xmc->enabled && xmc->state == XMC_STATE_ENABLED) {
+		for (off = 0; off < len; off += sizeof(u32))
+			buf[off / sizeof(u32)] = READ_REG32(xmc, off);
+	} else {
+		memset(buf, 0, len);
+		ret = -ENODEV;
+	}
+	mutex_unlock(&xmc->xmc_lock);
+
+	return ret;
+}
+
+/*
+ * Sensor sampler, mgmt pf only. A thread reads the whole XMC sensor block
+ * and the sysmon values at smp_hz into a ring, so that short power or
+ * thermal spikes between two sysfs scrapes are not lost.
+ */
+static void xmc_sample_push(struct xocl_xmc *xmc,
+	struct xclmgmt_sensor_sample *s)
+{
+	spin_lock(&xmc->smp_lock);
+	s->seq = xmc->smp_seq++;
+	xmc->smp_ring[xmc->smp_head] = *s;
+	xmc->smp_head = (xmc->smp_head + 1) % xmc->smp_len;
+	if (xmc->smp_cnt < xmc->smp_len)
+		xmc->smp_cnt++;
+	spin_unlock(&xmc->smp_lock);
+}
+
+static int xmc_sample_one(struct xocl_xmc *xmc,
+	struct xclmgmt_sensor_sample *s)
+{
+	xdev_handle_t xdev = xocl_get_xdev(xmc->pdev);
+	int ret;
+
+	BUILD_BUG_ON(sizeof(s->xmc) != XOCL_XMC_SENSOR_BLOCK_SZ);
+
+	s->ts_ns = ktime_get_ns();
+	ret = xmc_get_sensors(xmc->pdev, s->xmc, sizeof(s->xmc));
+	if (ret)
+		return ret;
+
+	(void) xocl_sysmon_get_prop(xdev, XOCL_SYSMON_PROP_TEMP, &s->temp);
+	(void) xocl_sysmon_get_prop(xdev, XOCL_SYSMON_PROP_VCC_INT,
+		&s->vcc_int);
+	(void) xocl_sysmon_get_prop(xdev, XOCL_SYSMON_PROP_VCC_AUX,
+		&s->vcc_aux);
+	(void) xocl_sysmon_get_prop(xdev, XOCL_SYSMON_PROP_VCC_BRAM,
+		&s->vcc_bram);
+	return 0;
+}
+
+static int xmc_sampler(void *arg)
+{
+	struct xocl_xmc *xmc = (struct xocl_xmc *)arg;
+	struct xclmgmt_sensor_sample s = { 0 };
+	u64 next = ktime_get_ns();
+	ktime_t to;
+	u64 now;
+
+	while (!kthread_should_stop()) {
+		if (xmc_sample_one(xmc, &s) == 0)
+			xmc_sample_push(xmc, &s);
+
+		/* Fixed rate, skip ahead instead of bursting after a stall. */
+		next += NSEC_PER_SEC / READ_ONCE(xmc->smp_hz);
+		now = ktime_get_ns();
+		if (next < now)
+			next = now;
+
+		to = ns_to_ktime(next);
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (kthread_should_stop()) {
+			__set_current_state(TASK_RUNNING);
+			break;
+		}
+		schedule_hrtimeout_range(&to, XMC_SAMPLE_SLACK_NS,
+			HRTIMER_MODE_ABS);
+	}
+
+	return 0;
+}
+
+/* Start, retune or (hz == 0) stop the sampler. */
+static int xmc_sampler_set_rate(struct xocl_xmc *xmc, unsigned int hz)
+{
+	struct xclmgmt_sensor_sample *ring;
+	struct task_struct *thread;
+	u32 len;
+	int ret = 0;
+
+	if (hz > XMC_SAMPLE_HZ_MAX)
+		return -EINVAL;
+
+	mutex_lock(&xmc->smp_ctl_lock);
+	if (hz == 0) {
+		if (xmc->smp_thread) {
+			kthread_stop(xmc->smp_thread);
+			xmc->smp_thread = NULL;
+		}
+		xmc->smp_hz = 0;
+		goto out;
+	}
+
+	WRITE_ONCE(xmc->smp_hz, hz);
+	if (xmc->smp_thread)
+		goto out;
+
+	/* The ring is kept across stop / start so samples stay readable. */
+	if (!xmc->smp_ring) {
+		len = clamp_t(u32, xmc_sample_ring_len, XMC_SAMPLE_RING_MIN,
+			XMC_SAMPLE_RING_MAX);
+		ring = vzalloc(len * sizeof(*ring));
+		if (!ring) {
+			ret = -ENOMEM;
+			goto fail;
+		}
+		spin_lock(&xmc->smp_lock);
+		xmc->smp_ring = ring;
+		xmc->smp_len = len;
+		spin_unlock(&xmc->smp_lock);
+	}
+
+	thread = kthread_run(xmc_sampler, xmc, "xmc_sampler");
+	if (IS_ERR(thread)) {
+		ret = PTR_ERR(thread);
+		goto fail;
+	}
+	xmc->smp_thread = thread;
+	xocl_info(&xmc->pdev->dev, "sensor sampler started at %u Hz", hz);
+	goto out;
+
+fail:
+	xmc->smp_hz = 0;
+out:
+	mutex_unlock(&xmc->smp_ctl_lock);
+	return ret;
 }
 
 /* sysfs support */
@@ -192,6 +421,10 @@ static void safe_read32(struct xocl_xmc *xmc, u32 reg, u32 *val)
 	mutex_lock(&xmc->xmc_lock);
 	if (xmc->enabled && xmc->state == XMC_STATE_ENABLED) {
 		*val = READ_REG32(xmc, reg);
+	} else if (xmc->enabled && !XMC_PRIVILEGED(xmc) &&
+		reg < XOCL_XMC_SENSOR_BLOCK_SZ &&
+		xmc_peer_snapshot_refresh(xmc) == 0) {
+		*val = xmc->peer_snap.xmc_regs[reg / sizeof(u32)];
 	} else {
 		*val = 0;
 	}
@@ -209,9 +442,11 @@ static void safe_write32(struct xocl_xmc *xmc, u32 reg, u32 val)
 
 static void safe_read_from_peer(struct xocl_xmc *xmc, struct platform_device *pdev, enum data_kind kind, u32 *val)
 {
+	size_t len = sizeof(u32);
+
 	mutex_lock(&xmc->xmc_lock);
 	if (xmc->enabled) {
-		xmc_read_from_peer(pdev, kind, val, sizeof(u32));
+		(void) xmc_read_from_peer(pdev, kind, val, &len);
 	} else {
 		*val = 0;
 	}
@@ -240,7 +475,7 @@ static ssize_t xmc_12v_pex_vol_show(struct device *dev, struct device_attribute
 	struct xocl_xmc *xmc = dev_get_drvdata(dev);
 	u32 pes_val;
 
-	if (XMC_PRIVILEGED(xmc))
+	if (XMC_PRIVILEGED(xmc) || xmc_peer_snapshot_supported(xmc))
 		safe_read32(xmc, XMC_12V_PEX_REG+sizeof(u32)*VOLTAGE_INS, &pes_val);
 	else{
 		safe_read_from_peer(xmc, to_platform_device(dev), VOL_12V_PEX, &pes_val);
@@ -809,6 +1044,217 @@ static DEVICE_ATTR_RO(host_msg_header);
 
 
 
+static ssize_t peer_health_show(struct device *dev, struct device_attribute *da,
+	char *buf)
+{
+	struct xocl_xmc *xmc = dev_get_drvdata(dev);
+	struct mailbox_sensor_snapshot *snap = &xmc->peer_snap;
+	ssize_t n = -ENODEV;
+
+	if (XMC_PRIVILEGED(xmc))
+		return n;
+
+	mutex_lock(&xmc->xmc_lock);
+	if (xmc_peer_snapshot_refresh(xmc) == 0) {
+		n = sprintf(buf, "temp %u vccint %u vccaux %u vccbram %u\n"
+			"firewall status 0x%x level %u detected 0x%x level %u "
+			"time %llu\n",
+			snap->sysmon[XOCL_SYSMON_PROP_TEMP],
+			snap->sysmon[XOCL_SYSMON_PROP_VCC_INT],
+			snap->sysmon[XOCL_SYSMON_PROP_VCC_AUX],
+			snap->sysmon[XOCL_SYSMON_PROP_VCC_BRAM],
+			snap->af_status, snap->af_level,
+			snap->af_detected_status, snap->af_detected_level,
+			snap->af_detected_time);
+	}
+	mutex_unlock(&xmc->xmc_lock);
+
+	return n;
+}
+/* Sysmon and firewall state of mgmt pf, as seen from user pf. */
+static DEVICE_ATTR_RO(peer_health);
+
+static ssize_t sensor_sample_hz_show(struct device *dev,
+	struct device_attribute *da, char *buf)
+{
+	struct xocl_xmc *xmc = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", xmc->smp_hz);
+}
+
+static ssize_t sensor_sample_hz_store(struct device *dev,
+	struct device_attribute *da, const char *buf, size_t count)
+{
+	struct xocl_xmc *xmc = dev_get_drvdata(dev);
+	unsigned int hz;
+	int ret;
+
+	if (!XMC_PRIVILEGED(xmc))
+		return -ENODEV;
+
+	if (kstrtouint(buf, 10, &hz) != 0)
+		return -EINVAL;
+
+	ret = xmc_sampler_set_rate(xmc, hz);
+	return ret ? ret : count;
+}
+/* Sampler rate in Hz, 0 stops it, mgmt pf only. */
+static DEVICE_ATTR_RW(sensor_sample_hz);
+
+static const struct {
+	const char	*name;
+	u32		reg;
+} xmc_sample_chans[] = {
+	{ "12v_pex_vol", XMC_12V_PEX_REG + sizeof(u32) * VOLTAGE_INS },
+	{ "12v_aux_vol", XMC_12V_AUX_REG + sizeof(u32) * VOLTAGE_INS },
+	{ "12v_pex_curr", XMC_12V_PEX_I_IN_REG + sizeof(u32) * VOLTAGE_INS },
+	{ "12v_aux_curr", XMC_12V_AUX_I_IN_REG + sizeof(u32) * VOLTAGE_INS },
+	{ "3v3_pex_vol", XMC_3V3_PEX_REG + sizeof(u32) * VOLTAGE_INS },
+	{ "3v3_aux_vol", XMC_3V3_AUX_REG + sizeof(u32) * VOLTAGE_INS },
+	{ "ddr_vpp_btm", XMC_DDR4_VPP_BTM_REG + sizeof(u32) * VOLTAGE_INS },
+	{ "sys_5v5", XMC_SYS_5V5_REG + sizeof(u32) * VOLTAGE_INS },
+	{ "1v2_top", XMC_VCC1V2_TOP_REG + sizeof(u32) * VOLTAGE_INS },
+	{ "1v8", XMC_VCC1V8_REG + sizeof(u32) * VOLTAGE_INS },
+	{ "0v85", XMC_VCC0V85_REG + sizeof(u32) * VOLTAGE_INS },
+	{ "ddr_vpp_top", XMC_DDR4_VPP_TOP_REG + sizeof(u32) * VOLTAGE_INS },
+	{ "mgt0v9avcc", XMC_MGT0V9AVCC_REG + sizeof(u32) * VOLTAGE_INS },
+	{ "12v_sw", XMC_12V_SW_REG + sizeof(u32) * VOLTAGE_INS },
+	{ "mgtavtt", XMC_MGTAVTT_REG + sizeof(u32) * VOLTAGE_INS },
+	{ "vcc1v2_btm", XMC_VCC1V2_BTM_REG + sizeof(u32) * VOLTAGE_INS },
+	{ "vccint_vol", XMC_VCCINT_V_REG + sizeof(u32) * VOLTAGE_INS },
+	{ "vccint_curr", XMC_VCCINT_I_REG + sizeof(u32) * VOLTAGE_INS },
+	{ "fpga_temp", XMC_FPGA_TEMP },
+	{ "fan_temp", XMC_FAN_TEMP_REG },
+	{ "fan_rpm", XMC_FAN_SPEED_REG },
+	{ "dimm_temp0", XMC_DIMM_TEMP0_REG + sizeof(u32) * VOLTAGE_INS },
+	{ "dimm_temp1", XMC_DIMM_TEMP1_REG + sizeof(u32) * VOLTAGE_INS },
+	{ "dimm_temp2", XMC_DIMM_TEMP2_REG + sizeof(u32) * VOLTAGE_INS },
+	{ "dimm_temp3", XMC_DIMM_TEMP3_REG + sizeof(u32) * VOLTAGE_INS },
+	{ "se98_temp0", XMC_SE98_TEMP0_REG + sizeof(u32) * VOLTAGE_INS },
+	{ "se98_temp1", XMC_SE98_TEMP1_REG + sizeof(u32) * VOLTAGE_INS },
+	{ "se98_temp2", XMC_SE98_TEMP2_REG + sizeof(u32) * VOLTAGE_INS },
+	{ "cage_temp0", XMC_CAGE_TEMP0_REG + sizeof(u32) * VOLTAGE_INS },
+	{ "cage_temp1", XMC_CAGE_TEMP1_REG + sizeof(u32) * VOLTAGE_INS },
+	{ "cage_temp2", XMC_CAGE_TEMP2_REG + sizeof(u32) * VOLTAGE_INS },
+	{ "cage_temp3", XMC_CAGE_TEMP3_REG + sizeof(u32) * VOLTAGE_INS },
+};
+
+/* Sysmon values follow the XMC channels in the stats arrays. */
+#define	XMC_SAMPLE_NCHANS	(ARRAY_SIZE(xmc_sample_chans) + 4)
+
+static u32 xmc_sample_chan(const struct xclmgmt_sensor_sample *s, int i)
+{
+	int n = ARRAY_SIZE(xmc_sample_chans);
+
+	if (i < n)
+		return s->xmc[xmc_sample_chans[i].reg / sizeof(u32)];
+	switch (i - n) {
+	case 0:
+		return s->temp;
+	case 1:
+		return s->vcc_int;
+	case 2:
+		return s->vcc_aux;
+	default:
+		return s->vcc_bram;
+	}
+}
+
+static const char *xmc_sample_chan_name(int i)
+{
+	static const char * const sysmon_names[] = {
+		"sysmon_temp", "sysmon_vccint", "sysmon_vccaux",
+		"sysmon_vccbram",
+	};
+	int n = ARRAY_SIZE(xmc_sample_chans);
+
+	return i < n ? xmc_sample_chans[i].name : sysmon_names[i - n];
+}
+
+static ssize_t sensor_stats_show(struct device *dev,
+	struct device_attribute *da, char *buf)
+{
+	struct xocl_xmc *xmc = dev_get_drvdata(dev);
+	struct xclmgmt_sensor_sample *batch, *s;
+	u64 window_ns = (u64)xmc_sample_window_ms * NSEC_PER_MSEC;
+	u64 now, seq;
+	u32 *min, *max;
+	u64 *sum;
+	u32 i, k, got, n = 0, head, len, total, slot, val;
+	ssize_t cnt = 0;
+	int c;
+
+	if (!XMC_PRIVILEGED(xmc))
+		return -ENODEV;
+
+	min = kcalloc(XMC_SAMPLE_NCHANS, 2 * sizeof(u32) + sizeof(u64),
+		GFP_KERNEL);
+	batch = kmalloc_array(XMC_SAMPLE_BATCH, sizeof(*batch), GFP_KERNEL);
+	if (!min || !batch) {
+		kfree(min);
+		kfree(batch);
+		return -ENOMEM;
+	}
+	max = min + XMC_SAMPLE_NCHANS;
+	sum = (u64 *)(max + XMC_SAMPLE_NCHANS);
+
+	spin_lock(&xmc->smp_lock);
+	now = ktime_get_ns();
+	head = xmc->smp_head;
+	len = xmc->smp_len;
+	total = xmc->smp_cnt;
+	seq = xmc->smp_seq;
+	spin_unlock(&xmc->smp_lock);
+
+	/*
+	 * Walk from the newest sample back to the start of the window, a
+	 * batch at a time so the sampler is never held off for long. Stop at
+	 * a sample the sampler has overwritten since, seen by its seq.
+	 */
+	for (i = 0; i < total; i += got) {
+		spin_lock(&xmc->smp_lock);
+		for (got = 0; got < XMC_SAMPLE_BATCH && i + got < total; got++) {
+			slot = (head + len - 1 - i - got) % len;
+			if (xmc->smp_ring[slot].seq != seq - 1 - i - got)
+				break;
+			batch[got] = xmc->smp_ring[slot];
+		}
+		spin_unlock(&xmc->smp_lock);
+
+		for (k = 0; k < got; k++) {
+			s = &batch[k];
+			if (now - s->ts_ns > window_ns)
+				goto done;
+			for (c = 0; c < XMC_SAMPLE_NCHANS; c++) {
+				val = xmc_sample_chan(s, c);
+				if (n == 0 || val < min[c])
+					min[c] = val;
+				if (n == 0 || val > max[c])
+					max[c] = val;
+				sum[c] += val;
+			}
+			n++;
+		}
+		if (got < XMC_SAMPLE_BATCH)
+			break;
+	}
+
+done:
+	cnt += sprintf(buf + cnt, "samples %u window_ms %u\n", n,
+		xmc_sample_window_ms);
+	for (c = 0; n && c < XMC_SAMPLE_NCHANS; c++) {
+		cnt += sprintf(buf + cnt, "%s %u %u %llu\n",
+			xmc_sample_chan_name(c), min[c], max[c],
+			div_u64(sum[c], n));
+	}
+
+	kfree(batch);
+	kfree(min);
+	return cnt;
+}
+/* Per sensor "name min max avg" over the last xmc_sample_window_ms. */
+static DEVICE_ATTR_RO(sensor_stats);
+
 static int get_temp_by_m_tag(struct xocl_xmc *xmc, char *m_tag)
 {
 
@@ -901,6 +1347,9 @@ static struct attribute *xmc_attrs[] = {
 	&dev_attr_xmc_cage_temp1.attr,
 	&dev_attr_xmc_cage_temp2.attr,
 	&dev_attr_xmc_cage_temp3.attr,
+	&dev_attr_peer_health.attr,
+	&dev_attr_sensor_sample_hz.attr,
+	&dev_attr_sensor_stats.attr,
 	&dev_attr_pause.attr,
 	&dev_attr_reset.attr,
 	&dev_attr_power_flag.attr,
@@ -960,8 +1409,64 @@ static struct bin_attribute bin_dimm_temp_by_mem_topology_attr = {
 	.size = 0
 };
 
+/*
+ * Raw ring of struct xclmgmt_sensor_sample, oldest first. The ring keeps
+ * moving between reads, read it in one go and use seq to spot overwrites.
+ */
+static ssize_t read_sensor_samples(struct file *filp, struct kobject *kobj,
+	struct bin_attribute *attr, char *buffer, loff_t offset, size_t count)
+{
+	struct xocl_xmc *xmc;
+	struct xclmgmt_sensor_sample smp;
+	size_t sz = sizeof(struct xclmgmt_sensor_sample);
+	size_t total, done = 0, chunk;
+	u32 oldest, slot, head, cnt, len, pos;
+	loff_t off;
+
+	xmc = (struct xocl_xmc *)dev_get_drvdata(container_of(kobj,
+		struct device, kobj));
+
+	spin_lock(&xmc->smp_lock);
+	head = xmc->smp_head;
+	cnt = xmc->smp_cnt;
+	len = xmc->smp_len;
+	spin_unlock(&xmc->smp_lock);
+
+	total = (size_t)cnt * sz;
+	if (offset >= total)
+		return 0;
+	if (count > total - offset)
+		count = total - offset;
+
+	oldest = (head + len - cnt) % len;
+
+	/* One sample per lock hold, seq tells readers about overwrites. */
+	for (off = offset; done < count; off += chunk, done += chunk) {
+		/* off < total, so the sample index fits in u32. */
+		slot = (oldest + (u32)div_u64_rem(off, sz, &pos)) % len;
+		chunk = min_t(size_t, sz - pos, count - done);
+		spin_lock(&xmc->smp_lock);
+		smp = xmc->smp_ring[slot];
+		spin_unlock(&xmc->smp_lock);
+		memcpy(buffer + done, (char *)&smp + pos, chunk);
+	}
+
+	return done;
+}
+
+static struct bin_attribute bin_sensor_samples_attr = {
+	.attr = {
+		.name = "sensor_samples",
+		.mode = 0444
+	},
+	.read = read_sensor_samples,
+	.write = NULL,
+	.size = 0
+};
+
 static struct bin_attribute *xmc_bin_attrs[] = {
 	&bin_dimm_temp_by_mem_topology_attr,
+	&bin_sensor_samples_attr,
 	NULL,
 };
 
@@ -1373,12 +1878,39 @@ static int load_sche_image(struct platform_device *pdev, const char *image,
 	return 0;
 }
 
+/*
+ * Board input power in mW, from the 12V PEX and 12V AUX rails (mV * mA).
+ * On user pf this is served from the sensor snapshot of mgmt pf.
+ */
+static int xmc_get_power(struct platform_device *pdev, u32 *mw)
+{
+	struct xocl_xmc *xmc = platform_get_drvdata(pdev);
+	u32 pex_v, pex_i, aux_v, aux_i;
+
+	if (!xmc || !xmc->enabled)
+		return -ENODEV;
+	if (!XMC_PRIVILEGED(xmc) && !xmc_peer_snapshot_supported(xmc))
+		return -EOPNOTSUPP;
+
+	safe_read32(xmc, XMC_12V_PEX_REG + sizeof(u32) * VOLTAGE_INS, &pex_v);
+	safe_read32(xmc, XMC_12V_PEX_I_IN_REG + sizeof(u32) * VOLTAGE_INS,
+		&pex_i);
+	safe_read32(xmc, XMC_12V_AUX_REG + sizeof(u32) * VOLTAGE_INS, &aux_v);
+	safe_read32(xmc, XMC_12V_AUX_I_IN_REG + sizeof(u32) * VOLTAGE_INS,
+		&aux_i);
+
+	*mw = (u32)div_u64((u64)pex_v * pex_i + (u64)aux_v * aux_i, 1000);
+	return 0;
+}
+
 static struct xocl_mb_funcs xmc_ops = {
 	.load_mgmt_image	= load_mgmt_image,
 	.load_sche_image	= load_sche_image,
 	.reset			= xmc_reset,
 	.stop			= stop_xmc,
 	.get_data     = xmc_get_data,
+	.get_sensors	= xmc_get_sensors,
+	.get_power	= xmc_get_power,
 };
 
 static int xmc_remove(struct platform_device *pdev)
@@ -1396,6 +1928,8 @@ static int xmc_remove(struct platform_device *pdev)
 	if (xmc->sche_binary)
 		devm_kfree(&pdev->dev, xmc->sche_binary);
 
+	(void) xmc_sampler_set_rate(xmc, 0);
+
 	mgmt_sysfs_destroy_xmc(pdev);
 
 	for (i = 0; i < NUM_IOADDR; i++) {
@@ -1403,6 +1937,8 @@ static int xmc_remove(struct platform_device *pdev)
 			iounmap(xmc->base_addrs[i]);
 	}
 
+	vfree(xmc->smp_ring);
+	mutex_destroy(&xmc->smp_ctl_lock);
 	mutex_destroy(&xmc->xmc_lock);
 
 	platform_set_drvdata(pdev, NULL);
@@ -1426,6 +1962,8 @@ static int xmc_probe(struct platform_device *pdev)
 
 	xmc->pdev = pdev;
 	platform_set_drvdata(pdev, xmc);
+	mutex_init(&xmc->smp_ctl_lock);
+	spin_lock_init(&xmc->smp_lock);
 
 	xdev_hdl = xocl_get_xdev(pdev);
 	if (xocl_mb_mgmt_on(xdev_hdl) || xocl_mb_sched_on(xdev_hdl)) {
@@ -1464,6 +2002,9 @@ static int xmc_probe(struct platform_device *pdev)
 
 	mutex_init(&xmc->xmc_lock);
 
+	if (XMC_PRIVILEGED(xmc) && xmc_sample_hz)
+		(void) xmc_sampler_set_rate(xmc, xmc_sample_hz);
+
 	return 0;
 
 failed:
@@ -101,6 +101,12 @@ struct xocl_dev	{
  * @num_cus: Number of resources (CUs) explcitly aquired
  * @lock: Mutex lock for exclusive access
  * @cu_bitmap: CUs reserved by this context, may contain implicit resources
+ * @energy_lock: Spin lock protecting the CU busy time bookkeeping below
+ * @energy_running: Number of commands of this context occupying a CU
+ * @energy_ts: Time (ns) energy_running last changed or was sampled
+ * @energy_busy_ns: CU busy time accumulated since the last energy tick
+ * @energy_tick_us: CU busy time of the last energy tick, used by the tick
+ * @energy_uj: Cumulative board energy attributed to this context
  */
 struct client_ctx {
 	struct list_head	link;
@@ -114,6 +120,12 @@ struct client_ctx {
 	struct xocl_dev        *xdev;
 	DECLARE_BITMAP(cu_bitmap, MAX_CUS);  /* may contain implicitly aquired resources such as CDMA */
 	struct pid             *pid;
+	spinlock_t		energy_lock;
+	u32			energy_running;
+	u64			energy_ts;
+	u64			energy_busy_ns;
+	u64			energy_tick_us;
+	u64			energy_uj;
 };
 
 struct xocl_mm_wrapper {
@@ -70,6 +70,7 @@ void xocl_reset_notify(struct pci_dev *pdev, bool prepare)
 		xocl_subdev_destroy_by_id(xdev, XOCL_SUBDEV_DMA);
 	} else {
 		reset_notify_client_ctx(xdev);
+		xocl_icap_peer_cache_invalidate(xdev);
 		xocl_subdev_create_by_id(xdev, XOCL_SUBDEV_DMA);
 		xocl_mailbox_reset(xdev, true);
 		xocl_exec_reset(xdev);
@@ -161,6 +162,7 @@ int xocl_reclock(struct xocl_dev *xdev, void *data)
 
 	err = xocl_peer_request(xdev, req, reqlen,
 		&msg, &resplen, NULL, NULL);
+	xocl_icap_peer_cache_invalidate(xdev);
 
 	if (msg != 0)
 		err = -ENODEV;
@@ -184,6 +186,9 @@ static void xocl_mailbox_srv(void *arg, void *data, size_t len,
 	case MAILBOX_REQ_FIREWALL:
 		(void) xocl_hot_reset(xdev, true);
 		break;
+	case MAILBOX_REQ_PEER_DATA_CHANGED:
+		xocl_icap_peer_cache_invalidate(xdev);
+		break;
 	default:
 		userpf_err(xdev, "dropped bad request (%d)\n", req->req);
 		break;
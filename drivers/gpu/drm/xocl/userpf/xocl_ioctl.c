@@ -194,7 +194,8 @@ xocl_read_axlf_helper(struct xocl_drm *drm_p, struct drm_xocl_axlf *axlf_ptr)
 	long err = 0;
 	struct axlf *axlf = 0;
 	struct axlf bin_obj;
-	size_t size;
+	size_t size, axlf_len = 0;
+	s64 copy_us = 0;
 	int preserve_mem = 0;
 	struct mem_topology *new_topology = NULL, *topology;
 	struct xocl_dev *xdev = drm_p->xdev;
@@ -252,19 +253,18 @@ xocl_read_axlf_helper(struct xocl_drm *drm_p, struct drm_xocl_axlf *axlf_ptr)
 
 	if (uuid_equal(xclbin_id, &bin_obj.m_header.uuid)) {
 		userpf_info(xdev, "Skipping repopulating topology, connectivity,ip_layout data\n");
+		xocl_icap_load_skipped(xdev);
 		goto done;
 	}
 
-	//Copy from user space and proceed.
-	axlf = vmalloc(bin_obj.m_header.m_length);
-	if (!axlf) {
+	/*
+	 * Copy from user space only the sections that the download path and
+	 * the peer need, and proceed.
+	 */
+	err = xocl_axlf_copy_from_user(xdev, axlf_ptr->xclbin, &axlf,
+		&axlf_len, &copy_us);
+	if (err) {
 		userpf_err(xdev, "Unable to create axlf\n");
-		err = -ENOMEM;
-		goto done;
-	}
-
-	if (copy_from_user(axlf, axlf_ptr->xclbin, bin_obj.m_header.m_length)) {
-		err = -EFAULT;
 		goto done;
 	}
 
@@ -302,7 +302,7 @@ xocl_read_axlf_helper(struct xocl_drm *drm_p, struct drm_xocl_axlf *axlf_ptr)
 		xocl_cleanup_mem(drm_p);
 	}
 
-	err = xocl_icap_download_axlf(xdev, axlf);
+	err = xocl_icap_download_axlf(xdev, axlf, axlf_len, copy_us);
 	if (err) {
 		userpf_err(xdev, "%s Fail to download\n", __func__);
 		/*
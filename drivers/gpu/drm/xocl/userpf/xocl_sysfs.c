@@ -302,6 +302,14 @@ static ssize_t link_speed_max_show(struct device *dev,
 	return sprintf(buf, "%d\n", speed);
 }
 static DEVICE_ATTR_RO(link_speed_max);
+static ssize_t subdev_probe_time_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct xocl_dev *xdev = dev_get_drvdata(dev);
+
+	return xocl_subdev_probe_report(xdev, buf);
+}
+static DEVICE_ATTR_RO(subdev_probe_time);
 /* - End attributes-- */
 
 static struct attribute *xocl_attrs[] = {
@@ -318,6 +326,7 @@ static struct attribute *xocl_attrs[] = {
 	&dev_attr_link_speed.attr,
 	&dev_attr_link_speed_max.attr,
 	&dev_attr_link_width_max.attr,
+	&dev_attr_subdev_probe_time.attr,
 	NULL,
 };
 
@@ -44,6 +44,7 @@ static inline void xocl_memcpy_toio(void *iomem, void *buf, u32 size)
 
 #define XOCL_MAX_DEVICES	16
 #define XOCL_EBUF_LEN           512
+#define XOCL_AXLF_MAX_SECTIONS  1024
 #define xocl_sysfs_error(xdev, fmt, args...)	 \
 	snprintf(((struct xocl_dev_core *)xdev)->ebuf, XOCL_EBUF_LEN,	\
 		 fmt, ##args)
@@ -117,6 +118,7 @@ struct client_ctx;
 struct xocl_subdev {
 	struct platform_device *pldev;
 	void                   *ops;
+	s64                    probe_us;
 };
 
 struct xocl_subdev_private {
@@ -238,6 +240,9 @@ enum data_kind {
 	DEBUG_IPLAYOUT_AXLF,
 	PEER_CONN,
 	XCLBIN_UUID,
+	PEER_PROT_VER,
+	DATA_CLK_MAX,
+	SENSOR_SNAPSHOT,
 };
 
 
@@ -450,6 +455,8 @@ struct xocl_firewall_funcs {
 	int (*get_prop)(struct platform_device *pdev, u32 prop, void *val);
 	int (*clear_firewall)(struct platform_device *pdev);
 	u32 (*check_firewall)(struct platform_device *pdev, int *level);
+	bool (*intr_enabled)(struct platform_device *pdev);
+	u32 (*get_status)(struct platform_device *pdev, int *level);
 };
 #define AF_DEV(xdev)	\
 	SUBDEV(xdev, XOCL_SUBDEV_AF).pldev
@@ -463,6 +470,10 @@ struct xocl_firewall_funcs {
 	(AF_DEV(xdev) ? AF_OPS(xdev)->check_firewall(AF_DEV(xdev), level) : 0)
 #define	xocl_af_clear(xdev)				\
 	(AF_DEV(xdev) ? AF_OPS(xdev)->clear_firewall(AF_DEV(xdev)) : -ENODEV)
+#define	xocl_af_intr_enabled(xdev)			\
+	(AF_DEV(xdev) ? AF_OPS(xdev)->intr_enabled(AF_DEV(xdev)) : false)
+#define	xocl_af_get_status(xdev, level)			\
+	(AF_DEV(xdev) ? AF_OPS(xdev)->get_status(AF_DEV(xdev), level) : 0)
 
 /* microblaze callbacks */
 struct xocl_mb_funcs {
@@ -473,6 +484,8 @@ struct xocl_mb_funcs {
 	int (*load_sche_image)(struct platform_device *pdev, const char *buf,
 		u32 len);
 	int (*get_data)(struct platform_device *pdev, enum data_kind kind);
+	int (*get_sensors)(struct platform_device *pdev, u32 *buf, size_t len);
+	int (*get_power)(struct platform_device *pdev, u32 *mw);
 };
 
 struct xocl_dna_funcs {
@@ -523,6 +536,12 @@ struct xocl_dna_funcs {
 
 #define xocl_xmc_get_data(xdev, cmd)			\
 	(XMC_DEV(xdev) ? XMC_OPS(xdev)->get_data(XMC_DEV(xdev), cmd) : -ENODEV)
+#define xocl_xmc_get_sensors(xdev, buf, len)		\
+	(XMC_DEV(xdev) && XMC_OPS(xdev) ?				\
+	XMC_OPS(xdev)->get_sensors(XMC_DEV(xdev), buf, len) : -ENODEV)
+#define xocl_xmc_get_power(xdev, mw)			\
+	(XMC_DEV(xdev) && XMC_OPS(xdev) ?				\
+	XMC_OPS(xdev)->get_power(XMC_DEV(xdev), mw) : -ENODEV)
 
 /*
  * mailbox callbacks
@@ -541,6 +560,9 @@ enum mailbox_request {
 	MAILBOX_REQ_RECLOCK,
 	MAILBOX_REQ_PEER_DATA,
 	MAILBOX_REQ_CONN_EXPL,
+	MAILBOX_REQ_LOAD_XCLBIN_UUID,
+	MAILBOX_REQ_PEER_DATA_CHANGED,
+	MAILBOX_REQ_MAX,
 };
 
 enum mb_cmd_type {
@@ -560,10 +582,36 @@ struct mailbox_subdev_peer {
 	enum data_kind kind;
 };
 
+/*
+ * Response to MAILBOX_REQ_PEER_DATA of kind SENSOR_SNAPSHOT. Carries the
+ * XMC register block from offset 0 up to and including the sensor flags,
+ * plus sysmon readings (indexed by XOCL_SYSMON_PROP_*) and firewall state.
+ */
+#define	XOCL_XMC_SENSOR_BLOCK_SZ	0x1AC
+struct mailbox_sensor_snapshot {
+	uint32_t xmc_regs[XOCL_XMC_SENSOR_BLOCK_SZ / sizeof(uint32_t)];
+	uint32_t sysmon[XOCL_SYSMON_PROP_VCC_BRAM_MIN + 1];
+	uint32_t af_status;
+	uint32_t af_level;
+	uint32_t af_detected_status;
+	uint32_t af_detected_level;
+	uint64_t af_detected_time;
+};
+
 struct mailbox_bitstream_kaddr {
 	uint64_t addr;
 };
 
+/*
+ * Descriptor for an xclbin the mgmt pf can read on its own, so that only
+ * the uuid crosses the mailbox. length is the size of the sender's copy,
+ * which may be compacted, and is informational only.
+ */
+struct mailbox_bitstream_uuid {
+	uuid_t uuid;
+	uint64_t length;
+};
+
 struct mailbox_gpctl {
 	enum mb_cmd_type cmd_type;
 	uint32_t data_total_len;
@@ -580,8 +628,16 @@ struct mailbox_req {
 };
 
 #define MB_PROT_VER_MAJOR 0
-#define MB_PROT_VER_MINOR 5
+#define MB_PROT_VER_MINOR 9
 #define MB_PROTOCOL_VER   ((MB_PROT_VER_MAJOR<<8) + MB_PROT_VER_MINOR)
+/* first protocol version that understands MAILBOX_REQ_LOAD_XCLBIN_UUID */
+#define MB_PROT_VER_XCLBIN_UUID	0x6
+/* first protocol version whose RX drains several packets per interrupt */
+#define MB_PROT_VER_TX_WINDOW	0x7
+/* first protocol version that accepts PKT_TYPE_PREEMPT */
+#define MB_PROT_VER_PREEMPT	0x8
+/* first protocol version that answers PEER_DATA of kind SENSOR_SNAPSHOT */
+#define MB_PROT_VER_SENSOR_SNAPSHOT	0x9
 
 #define MB_PEER_CONNECTED 0x1
 #define MB_PEER_SAME_DOM  0x2
@@ -592,7 +648,7 @@ typedef	void (*mailbox_msg_cb_t)(void *arg, void *data, size_t len,
 struct xocl_mailbox_funcs {
 	int (*request)(struct platform_device *pdev, void *req,
 		size_t reqlen, void *resp, size_t *resplen,
-		mailbox_msg_cb_t cb, void *cbarg);
+		mailbox_msg_cb_t cb, void *cbarg, u32 timeout_ms);
 	int (*post)(struct platform_device *pdev, u64 req_id,
 		void *resp, size_t len);
 	int (*listen)(struct platform_device *pdev,
@@ -605,8 +661,12 @@ struct xocl_mailbox_funcs {
 	((struct xocl_mailbox_funcs *)SUBDEV(xdev, XOCL_SUBDEV_MAILBOX).ops)
 #define MAILBOX_READY(xdev)	(MAILBOX_DEV(xdev) && MAILBOX_OPS(xdev))
 #define	xocl_peer_request(xdev, req, reqlen, resp, resplen, cb, cbarg)		\
+	xocl_peer_request_timeout(xdev, req, reqlen, resp, resplen, cb, cbarg, 0)
+/* timeout_ms of 0 picks the default for the request type. */
+#define	xocl_peer_request_timeout(xdev, req, reqlen, resp, resplen, cb,	\
+	cbarg, timeout_ms)						\
 	(MAILBOX_READY(xdev) ? MAILBOX_OPS(xdev)->request(MAILBOX_DEV(xdev), \
-	req, reqlen, resp, resplen, cb, cbarg) : -ENODEV)
+	req, reqlen, resp, resplen, cb, cbarg, timeout_ms) : -ENODEV)
 #define	xocl_peer_response(xdev, reqid, buf, len)			\
 	(MAILBOX_READY(xdev) ? MAILBOX_OPS(xdev)->post(MAILBOX_DEV(xdev), \
 	reqid, buf, len) : -ENODEV)
@@ -627,19 +687,26 @@ struct xocl_icap_funcs {
 	void (*reset_axi_gate)(struct platform_device *pdev);
 	int (*reset_bitstream)(struct platform_device *pdev);
 	int (*download_bitstream_axlf)(struct platform_device *pdev,
-		const void __user *arg);
+		const void __user *arg, size_t len, s64 copy_us);
+	int (*stage_bitstream_axlf)(struct platform_device *pdev,
+		const void *arg, size_t len);
+	int (*commit_bitstream_axlf)(struct platform_device *pdev);
 	int (*download_boot_firmware)(struct platform_device *pdev);
 	int (*ocl_set_freq)(struct platform_device *pdev,
 		unsigned int region, unsigned short *freqs, int num_freqs);
 	int (*ocl_get_freq)(struct platform_device *pdev,
 		unsigned int region, unsigned short *freqs, int num_freqs);
 	int (*ocl_update_clock_freq_topology)(struct platform_device *pdev, struct xclmgmt_ioc_freqscaling *freqs);
+	int (*ocl_update_clock_freq_idle)(struct platform_device *pdev,
+		struct xclmgmt_ioc_freqscaling *freqs);
 	int (*ocl_lock_bitstream)(struct platform_device *pdev,
 		const uuid_t *uuid, pid_t pid);
 	int (*ocl_unlock_bitstream)(struct platform_device *pdev,
 		const uuid_t *uuid, pid_t pid);
 	uint64_t (*get_data)(struct platform_device *pdev,
 		enum data_kind kind);
+	void (*peer_cache_invalidate)(struct platform_device *pdev);
+	void (*load_skipped)(struct platform_device *pdev);
 };
 #define	ICAP_DEV(xdev)	SUBDEV(xdev, XOCL_SUBDEV_ICAP).pldev
 #define	ICAP_OPS(xdev)							\
@@ -652,9 +719,17 @@ struct xocl_icap_funcs {
 	(ICAP_OPS(xdev) ?						\
 	ICAP_OPS(xdev)->reset_bitstream(ICAP_DEV(xdev)) :		\
 	-ENODEV)
-#define	xocl_icap_download_axlf(xdev, xclbin)				\
+#define	xocl_icap_download_axlf(xdev, xclbin, len, copy_us)		\
 	(ICAP_OPS(xdev) ?						\
-	ICAP_OPS(xdev)->download_bitstream_axlf(ICAP_DEV(xdev), xclbin) : \
+	ICAP_OPS(xdev)->download_bitstream_axlf(ICAP_DEV(xdev), xclbin,	\
+	len, copy_us) : -ENODEV)
+#define	xocl_icap_stage_axlf(xdev, xclbin, len)				\
+	(ICAP_OPS(xdev) ?						\
+	ICAP_OPS(xdev)->stage_bitstream_axlf(ICAP_DEV(xdev), xclbin, len) : \
+	-ENODEV)
+#define	xocl_icap_commit_axlf(xdev)					\
+	(ICAP_OPS(xdev) ?						\
+	ICAP_OPS(xdev)->commit_bitstream_axlf(ICAP_DEV(xdev)) :	\
 	-ENODEV)
 #define	xocl_icap_download_boot_firmware(xdev)				\
 	(ICAP_OPS(xdev) ?						\
@@ -668,6 +743,10 @@ struct xocl_icap_funcs {
 	(ICAP_OPS(xdev) ?						\
 	ICAP_OPS(xdev)->ocl_update_clock_freq_topology(ICAP_DEV(xdev), freqs) : \
 	-ENODEV)
+#define	xocl_icap_ocl_update_clock_freq_idle(xdev, freqs)		\
+	(ICAP_OPS(xdev) ?						\
+	ICAP_OPS(xdev)->ocl_update_clock_freq_idle(ICAP_DEV(xdev), freqs) : \
+	-ENODEV)
 #define	xocl_icap_ocl_set_freq(xdev, region, freqs, num)		\
 	(ICAP_OPS(xdev) ?						\
 	ICAP_OPS(xdev)->ocl_set_freq(ICAP_DEV(xdev), region, freqs, num) : \
@@ -684,6 +763,16 @@ struct xocl_icap_funcs {
 	(ICAP_OPS(xdev) ?						\
 	ICAP_OPS(xdev)->get_data(ICAP_DEV(xdev), kind) : \
 	0)
+#define	xocl_icap_peer_cache_invalidate(xdev)				\
+	do {								\
+		if (ICAP_DEV(xdev))					\
+			ICAP_OPS(xdev)->peer_cache_invalidate(ICAP_DEV(xdev)); \
+	} while (0)
+#define	xocl_icap_load_skipped(xdev)					\
+	do {								\
+		if (ICAP_DEV(xdev))					\
+			ICAP_OPS(xdev)->load_skipped(ICAP_DEV(xdev));	\
+	} while (0)
 
 /* helper functions */
 xdev_handle_t xocl_get_xdev(struct platform_device *pdev);
@@ -701,8 +790,11 @@ void xocl_subdev_destroy_one(xdev_handle_t xdev_hdl, u32 subdev_id);
 void xocl_subdev_destroy_all(xdev_handle_t xdev_hdl);
 void xocl_subdev_destroy_by_id(xdev_handle_t xdev_hdl, int id);
 
+ssize_t xocl_subdev_probe_report(xdev_handle_t xdev_hdl, char *buf);
 int xocl_subdev_create_by_name(xdev_handle_t xdev_hdl, char *name);
 int xocl_subdev_destroy_by_name(xdev_handle_t xdev_hdl, char *name);
+int xocl_subdev_for_each_inst(xdev_handle_t xdev_hdl, u32 id,
+	int (*fn)(struct platform_device *pldev, void *arg), void *arg);
 
 int xocl_subdev_get_devinfo(uint32_t subdev_id,
 			    struct xocl_subdev_info *subdev_info, struct resource *res);
@@ -712,6 +804,9 @@ void xocl_subdev_register(struct platform_device *pldev, u32 id,
 void xocl_fill_dsa_priv(xdev_handle_t xdev_hdl, struct xocl_board_private *in);
 int xocl_xrt_version_check(xdev_handle_t xdev_hdl,
 			   struct axlf *bin_obj, bool major_only);
+int xocl_axlf_copy_from_user(xdev_handle_t xdev_hdl,
+	const void __user *u_xclbin, struct axlf **xclbin, size_t *len,
+	s64 *copy_us);
 int xocl_alloc_dev_minor(xdev_handle_t xdev_hdl);
 void xocl_free_dev_minor(xdev_handle_t xdev_hdl);
 
@@ -771,6 +866,8 @@ void xocl_fini_icap(void);
 
 int __init xocl_init_mig(void);
 void xocl_fini_mig(void);
+int xocl_mig_get_ecc(xdev_handle_t xdev_hdl, struct xclmgmt_mig_ecc *ecc,
+	u32 max);
 
 int __init xocl_init_xmc(void);
 void xocl_fini_xmc(void);
@@ -9,6 +9,9 @@
 
 #include <linux/pci.h>
 #include <linux/platform_device.h>
+#include <linux/vmalloc.h>
+#include <linux/uaccess.h>
+#include <linux/ktime.h>
 #include "xclfeatures.h"
 #include "xocl_drv.h"
 #include "version.h"
@@ -20,6 +23,12 @@ struct xocl_subdev_array {
 	int count;
 };
 
+struct xocl_subdev_iter {
+	u32 id;
+	int (*fn)(struct platform_device *pldev, void *arg);
+	void *arg;
+};
+
 static DEFINE_IDA(xocl_dev_minor_ida);
 
 static DEFINE_IDA(subdev_multi_inst_ida);
@@ -167,6 +176,7 @@ int xocl_subdev_create_one(xdev_handle_t xdev_hdl,
 	struct xocl_dev_core *core = (struct xocl_dev_core *)xdev_hdl;
 	struct pci_dev *pdev = core->pdev;
 	u32	id = sdev_info->id;
+	ktime_t	start = ktime_get();
 	int	ret = 0;
 
 	if (core->subdevs[id].pldev)
@@ -191,7 +201,9 @@ int xocl_subdev_create_one(xdev_handle_t xdev_hdl,
 		ret = -ENODEV;
 		goto failed;
 	}
-	xocl_info(&pdev->dev, "Created subdev %s", sdev_info->name);
+	core->subdevs[id].probe_us = ktime_us_delta(ktime_get(), start);
+	xocl_info(&pdev->dev, "Created subdev %s in %lld us", sdev_info->name,
+		core->subdevs[id].probe_us);
 
 	return 0;
 
@@ -258,6 +270,7 @@ int xocl_subdev_create_all(xdev_handle_t xdev_hdl,
 {
 	struct xocl_dev_core *core = (struct xocl_dev_core *)xdev_hdl;
 	struct FeatureRomHeader rom;
+	ktime_t	start;
 	u32	id;
 	int	i, ret = 0;
 
@@ -288,6 +301,7 @@ int xocl_subdev_create_all(xdev_handle_t xdev_hdl,
 	core->subdev_num = subdev_num;
 
 	/* create subdevices */
+	start = ktime_get();
 	for (i = 0; i < core->subdev_num; i++) {
 		id = sdev_info[i].id;
 		if (core->subdevs[id].pldev)
@@ -297,6 +311,8 @@ int xocl_subdev_create_all(xdev_handle_t xdev_hdl,
 		if (ret)
 			goto failed;
 	}
+	xocl_info(&core->pdev->dev, "Created %d subdevs in %lld us",
+		core->subdev_num, ktime_us_delta(ktime_get(), start));
 
 	return 0;
 
@@ -305,6 +321,23 @@ int xocl_subdev_create_all(xdev_handle_t xdev_hdl,
 	return ret;
 }
 
+ssize_t xocl_subdev_probe_report(xdev_handle_t xdev_hdl, char *buf)
+{
+	struct xocl_dev_core *core = (struct xocl_dev_core *)xdev_hdl;
+	ssize_t count = 0;
+	int i;
+
+	for (i = 0; i < XOCL_SUBDEV_NUM; i++) {
+		if (!core->subdevs[i].pldev)
+			continue;
+		count += sprintf(buf + count, "%s %lld\n",
+			core->subdevs[i].pldev->name,
+			core->subdevs[i].probe_us);
+	}
+
+	return count;
+}
+
 void xocl_subdev_destroy_one(xdev_handle_t xdev_hdl, uint32_t subdev_id)
 {
 	struct xocl_dev_core *core = (struct xocl_dev_core *)xdev_hdl;
@@ -418,6 +451,39 @@ void xocl_subdev_destroy_all(xdev_handle_t xdev_hdl)
 	core->subdev_num = 0;
 }
 
+static int xocl_subdev_iter_one(struct device *dev, void *data)
+{
+	struct xocl_subdev_iter *it = (struct xocl_subdev_iter *)data;
+	struct xocl_subdev_private *priv;
+
+	if (dev->bus != &platform_bus_type)
+		return 0;
+	priv = dev_get_platdata(dev);
+	if (!priv || priv->id != it->id)
+		return 0;
+
+	return it->fn(to_platform_device(dev), it->arg);
+}
+
+/*
+ * Call fn on every instance of subdev id under this device, including the
+ * multi instance ones which have no slot in core->subdevs. A non-zero
+ * return from fn stops the walk and is passed back.
+ */
+int xocl_subdev_for_each_inst(xdev_handle_t xdev_hdl, u32 id,
+	int (*fn)(struct platform_device *pldev, void *arg), void *arg)
+{
+	struct xocl_dev_core *core = (struct xocl_dev_core *)xdev_hdl;
+	struct xocl_subdev_iter it = {
+		.id = id,
+		.fn = fn,
+		.arg = arg,
+	};
+
+	return device_for_each_child(&core->pdev->dev, &it,
+		xocl_subdev_iter_one);
+}
+
 void xocl_subdev_register(struct platform_device *pldev, u32 id,
 	void *cb_funcs)
 {
@@ -512,6 +578,141 @@ int xocl_xrt_version_check(xdev_handle_t xdev_hdl,
 	return -EINVAL;
 }
 
+/*
+ * Sections read by the icap download, DNA verify and peer forwarding paths
+ * on either PF. The xclbin header itself, used by the version and timestamp
+ * checks, is always kept.
+ */
+static const enum axlf_section_kind xocl_axlf_kinds[] = {
+	BITSTREAM,
+	CLEARING_BITSTREAM,
+	CLOCK_FREQ_TOPOLOGY,
+	MEM_TOPOLOGY,
+	IP_LAYOUT,
+	CONNECTIVITY,
+	DEBUG_IP_LAYOUT,
+	DNA_CERTIFICATE,
+};
+
+static bool xocl_axlf_kind_wanted(uint32_t kind)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(xocl_axlf_kinds); i++) {
+		if (xocl_axlf_kinds[i] == kind)
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Copy an xclbin in from user space, keeping only the header, the section
+ * table entries for the kinds in xocl_axlf_kinds[] and their payloads.
+ * Offsets and the total length are rewritten to describe the compacted
+ * image, so it can be handed to the icap download path as if it were the
+ * full file. The size of the returned buffer is stored in len and the time
+ * spent copying in copy_us. The caller owns the buffer and releases it with
+ * vfree().
+ */
+int xocl_axlf_copy_from_user(xdev_handle_t xdev_hdl,
+	const void __user *u_xclbin, struct axlf **xclbin, size_t *len,
+	s64 *copy_us)
+{
+	struct device *dev = &XDEV(xdev_hdl)->pdev->dev;
+	ktime_t start = ktime_get();
+	struct axlf bin_obj;
+	struct axlf_section_header *sects = NULL;
+	struct axlf *out = NULL;
+	uint64_t xclbin_len, total = 0, off;
+	size_t sects_len, hdr_len;
+	uint32_t i, nsect, nkept = 0;
+	int err = 0;
+
+	*xclbin = NULL;
+
+	if (copy_from_user(&bin_obj, u_xclbin, sizeof(bin_obj)))
+		return -EFAULT;
+
+	xclbin_len = bin_obj.m_header.m_length;
+	nsect = bin_obj.m_header.m_numSections;
+	if (nsect == 0 || nsect > XOCL_AXLF_MAX_SECTIONS)
+		return -EINVAL;
+
+	sects_len = nsect * sizeof(struct axlf_section_header);
+	if (offsetof(struct axlf, m_sections) + sects_len > xclbin_len)
+		return -EINVAL;
+
+	sects = vmalloc(sects_len);
+	if (!sects)
+		return -ENOMEM;
+
+	if (copy_from_user(sects, (const char __user *)u_xclbin +
+		offsetof(struct axlf, m_sections), sects_len)) {
+		err = -EFAULT;
+		goto done;
+	}
+
+	for (i = 0; i < nsect; i++) {
+		if (!xocl_axlf_kind_wanted(sects[i].m_sectionKind))
+			continue;
+		if (sects[i].m_sectionOffset > xclbin_len ||
+			sects[i].m_sectionSize >
+			xclbin_len - sects[i].m_sectionOffset) {
+			xocl_err(dev, "section %d extends beyond xclbin",
+				sects[i].m_sectionKind);
+			err = -EINVAL;
+			goto done;
+		}
+		total += ALIGN(sects[i].m_sectionSize, 8);
+		nkept++;
+	}
+
+	hdr_len = ALIGN(offsetof(struct axlf, m_sections) +
+		max_t(uint32_t, nkept, 1) * sizeof(struct axlf_section_header),
+		8);
+	out = vzalloc(hdr_len + total);
+	if (!out) {
+		err = -ENOMEM;
+		goto done;
+	}
+
+	memcpy(out, &bin_obj, offsetof(struct axlf, m_sections));
+	off = hdr_len;
+	for (i = 0, nkept = 0; i < nsect; i++) {
+		struct axlf_section_header *hdr;
+
+		if (!xocl_axlf_kind_wanted(sects[i].m_sectionKind))
+			continue;
+		if (copy_from_user((char *)out + off, (const char __user *)
+			u_xclbin + sects[i].m_sectionOffset,
+			sects[i].m_sectionSize)) {
+			err = -EFAULT;
+			goto done;
+		}
+		hdr = &out->m_sections[nkept++];
+		*hdr = sects[i];
+		hdr->m_sectionOffset = off;
+		off += ALIGN(sects[i].m_sectionSize, 8);
+	}
+	out->m_header.m_numSections = nkept;
+	out->m_header.m_length = hdr_len + total;
+
+	*copy_us = ktime_us_delta(ktime_get(), start);
+	xocl_info(dev, "copied %llu of %llu xclbin bytes, %u of %u sections"
+		" in %lld us", out->m_header.m_length, xclbin_len, nkept, nsect,
+		*copy_us);
+
+	*xclbin = out;
+	*len = hdr_len + total;
+	out = NULL;
+
+done:
+	vfree(out);
+	vfree(sects);
+	return err;
+}
+
 int xocl_alloc_dev_minor(xdev_handle_t xdev_hdl)
 {
 	struct xocl_dev_core *core = (struct xocl_dev_core *)xdev_hdl;
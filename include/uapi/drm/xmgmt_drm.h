@@ -16,6 +16,8 @@
  * 6    Device sensors (current, voltage and   NA                             *hwmon* (xclmgmt_microblaze and
  *      temperature)                                                          xclmgmt_sysmon) interface on sysfs
  * 7    Querying device errors                 XCLMGMT_IOCERRINFO             xclErrorStatus
+ * 8    Stage FPGA image for later download    XCLMGMT_IOCICAPSTAGE_AXLF      xclmgmt_ioc_bitstream_axlf
+ * 9    Download staged FPGA image             XCLMGMT_IOCICAPCOMMIT_AXLF     NA
  * ==== ====================================== ============================== ==================================
  *
  */
@@ -91,6 +93,8 @@ enum XCLMGMT_IOC_TYPES {
 	XCLMGMT_IOC_REBOOT,
 	XCLMGMT_IOC_ICAP_DOWNLOAD_AXLF,
 	XCLMGMT_IOC_ERR_INFO,
+	XCLMGMT_IOC_ICAP_STAGE_AXLF,
+	XCLMGMT_IOC_ICAP_COMMIT_AXLF,
 	XCLMGMT_IOC_MAX
 };
 
@@ -166,7 +170,7 @@ struct xclmgmt_err_info {
 
 /**
  * struct xclmgmt_ioc_bitstream_axlf - load xclbin (AXLF) device image
- * used with XCLMGMT_IOCICAPDOWNLOAD_AXLF ioctl
+ * used with XCLMGMT_IOCICAPDOWNLOAD_AXLF and XCLMGMT_IOCICAPSTAGE_AXLF ioctls
  *
  * @xclbin:	Pointer to user's xclbin structure in memory
  */
@@ -186,6 +190,89 @@ struct xclmgmt_ioc_freqscaling {
 	unsigned short ocl_target_freq[XCLMGMT_NUM_SUPPORTED_CLOCKS];
 };
 
+/**
+ * struct xclmgmt_sensor_sample - one record of the xmc sensor_samples stream
+ * read from sysfs, oldest record first
+ *
+ * @seq:	Sample sequence number, gaps mean records were overwritten
+ * @ts_ns:	CLOCK_MONOTONIC time the sample was taken, in ns
+ * @xmc:	Raw XMC sensor register block (max, average, instant triples)
+ * @temp:	FPGA die temperature from sysmon, in degree C
+ * @vcc_int:	VCCINT from sysmon, in mV
+ * @vcc_aux:	VCCAUX from sysmon, in mV
+ * @vcc_bram:	VCCBRAM from sysmon, in mV
+ */
+#define	XCLMGMT_XMC_SENSOR_WORDS	107
+struct xclmgmt_sensor_sample {
+	uint64_t seq;
+	uint64_t ts_ns;
+	uint32_t xmc[XCLMGMT_XMC_SENSOR_WORDS];
+	uint32_t temp;
+	uint32_t vcc_int;
+	uint32_t vcc_aux;
+	uint32_t vcc_bram;
+	uint32_t padding;
+};
+
+/**
+ * struct xclmgmt_mig_ecc - ECC state of one memory controller
+ *
+ * @tag:	Memory bank tag from mem topology, e.g. bank0 or DDR[0]
+ * @ecc_enabled: ECC on/off register
+ * @ecc_status:	ECC status register
+ * @ecc_ce_cnt:	Correctable error count
+ * @ecc_ce_ffa:	First failing address of a correctable error
+ * @ecc_ue_ffa:	First failing address of an uncorrectable error
+ */
+struct xclmgmt_mig_ecc {
+	char     tag[16];
+	uint32_t ecc_enabled;
+	uint32_t ecc_status;
+	uint32_t ecc_ce_cnt;
+	uint32_t padding;
+	uint64_t ecc_ce_ffa;
+	uint64_t ecc_ue_ffa;
+};
+
+/**
+ * struct xclmgmt_sensor_dump - all board sensors, read from the mgmt pf
+ * sensor_dump sysfs node in one go
+ *
+ * @version:	XCLMGMT_SENSOR_DUMP_VERSION of the layout
+ * @size:	Size of the structure filled in by the driver
+ * @ts_ns:	CLOCK_MONOTONIC time the dump was taken, in ns
+ * @xmc_valid:	Non zero if @xmc holds data, XMC may be absent or stopped
+ * @xmc:	Raw XMC sensor register block (max, average, instant triples)
+ * @sysmon:	Sysmon temperature (C) and voltages (mV): temp, vccint,
+ *		vccaux and vccbram, each followed by its max and min
+ * @af_status:	AXI firewall current status, 0 if not tripped
+ * @af_level:	AXI firewall level that tripped, -1 if none
+ * @af_detected_status: AXI firewall status when a trip was first detected
+ * @af_detected_level: AXI firewall level when a trip was first detected
+ * @af_detected_time: Time in seconds a trip was first detected
+ * @mig_count:	Number of valid entries in @mig
+ * @mig:	ECC state of each memory controller in the current xclbin
+ */
+#define	XCLMGMT_SENSOR_DUMP_VERSION	1
+#define	XCLMGMT_SYSMON_VALUES		12
+#define	XCLMGMT_MAX_MIG			64
+struct xclmgmt_sensor_dump {
+	uint32_t version;
+	uint32_t size;
+	uint64_t ts_ns;
+	uint32_t xmc_valid;
+	uint32_t xmc[XCLMGMT_XMC_SENSOR_WORDS];
+	uint32_t sysmon[XCLMGMT_SYSMON_VALUES];
+	uint32_t af_status;
+	int32_t  af_level;
+	uint32_t af_detected_status;
+	uint32_t af_detected_level;
+	uint64_t af_detected_time;
+	uint32_t mig_count;
+	uint32_t padding;
+	struct xclmgmt_mig_ecc mig[XCLMGMT_MAX_MIG];
+};
+
 #define XCLMGMT_IOCINFO			 _IOR(XCLMGMT_IOC_MAGIC, XCLMGMT_IOC_INFO, \
 					      struct xclmgmt_ioc_info)
 #define XCLMGMT_IOCICAPDOWNLOAD		 _IOW(XCLMGMT_IOC_MAGIC, XCLMGMT_IOC_ICAP_DOWNLOAD, \
@@ -198,6 +285,9 @@ struct xclmgmt_ioc_freqscaling {
 #define XCLMGMT_IOCOCLRESET		 _IO(XCLMGMT_IOC_MAGIC, XCLMGMT_IOC_OCL_RESET)
 #define XCLMGMT_IOCREBOOT		 _IO(XCLMGMT_IOC_MAGIC, XCLMGMT_IOC_REBOOT)
 #define XCLMGMT_IOCERRINFO		 _IOR(XCLMGMT_IOC_MAGIC, XCLMGMT_IOC_ERR_INFO, struct xclErrorStatus)
+#define XCLMGMT_IOCICAPSTAGE_AXLF	 _IOW(XCLMGMT_IOC_MAGIC, XCLMGMT_IOC_ICAP_STAGE_AXLF, \
+					      struct xclmgmt_ioc_bitstream_axlf)
+#define XCLMGMT_IOCICAPCOMMIT_AXLF	 _IO(XCLMGMT_IOC_MAGIC, XCLMGMT_IOC_ICAP_COMMIT_AXLF)
 
 #define	XCLMGMT_MB_HWMON_NAME	    "xclmgmt_microblaze"
 #define XCLMGMT_SYSMON_HWMON_NAME   "xclmgmt_sysmon"